@@ -0,0 +1,166 @@
+#pragma once
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "object.hpp"
+#include "value.hpp"
+
+class VM;
+
+// Typed natives: define_native<&fn>("name") binds a plain function such as
+// `int sum(ObjArray *)` or `ObjString *substr(VM &, ObjString *, int, std::optional<int>)`.
+// The generated thunk checks the argument count and types, unpacks them and boxes the
+// result. A leading VM & is passed through, trailing std::optional parameters may be left out.
+namespace binding
+{
+	std::string_view type_name(const Value &value);
+
+	template <typename T>
+	struct Arg;
+
+	template <>
+	struct Arg<Value>
+	{
+		static constexpr std::string_view name_ = "value";
+		static bool is(const Value &) { return true; }
+		static Value get(const Value &value) { return value; }
+	};
+
+	template <>
+	struct Arg<int>
+	{
+		static constexpr std::string_view name_ = "number";
+		static bool is(const Value &value) { return value.is_number(); }
+		static int get(const Value &value) { return value.as<int>(); }
+	};
+
+	template <>
+	struct Arg<bool>
+	{
+		static constexpr std::string_view name_ = "bool";
+		static bool is(const Value &value) { return value.is_bool(); }
+		static bool get(const Value &value) { return value.as<bool>(); }
+	};
+
+	template <typename T>
+	struct Arg<T *>
+	{
+		static_assert(std::is_base_of_v<Obj, T>);
+		static constexpr std::string_view name_ = nameof<T>();
+		static bool is(const Value &value) { return value.is_obj_type<T>(); }
+		static T *get(const Value &value) { return value.as_obj<T>(); }
+	};
+
+	template <typename T>
+	struct Param
+	{
+		using type = T;
+		static constexpr bool optional_ = false;
+	};
+
+	template <typename T>
+	struct Param<std::optional<T>>
+	{
+		using type = T;
+		static constexpr bool optional_ = true;
+	};
+
+	template <typename T>
+	Value box(T &&result)
+	{
+		if constexpr (std::is_pointer_v<std::decay_t<T>>)
+			return Value(static_cast<Obj *>(result));
+		else
+			return Value(std::forward<T>(result));
+	}
+
+	template <typename P>
+	P unpack(Value *args, int argCount, int index)
+	{
+		using Type = typename Param<P>::type;
+		if constexpr (Param<P>::optional_)
+		{
+			if (index >= argCount)
+				return std::nullopt;
+		}
+		auto &value = args[index];
+		if (!Arg<Type>::is(value))
+			throw NativeError("Expected " + std::string(Arg<Type>::name_) + " as argument " + std::to_string(index + 1) +
+							  " but got " + std::string(type_name(value)) + ".");
+		return Arg<Type>::get(value);
+	}
+
+	template <typename... Params>
+	constexpr int required_count()
+	{
+		int count = 0;
+		bool seen_optional = false;
+		((Param<Params>::optional_ ? (void)(seen_optional = true) : (void)(count += !seen_optional)), ...);
+		return count;
+	}
+
+	template <typename... Params>
+	constexpr bool optionals_trail()
+	{
+		bool seen_optional = false, ok = true;
+		((Param<Params>::optional_ ? (void)(seen_optional = true) : (void)(ok = ok && !seen_optional)), ...);
+		return ok;
+	}
+
+	template <auto Fn, bool WithVM, typename R, typename... Params, size_t... I>
+	Value call(VM &vm, int argCount, [[maybe_unused]] Value *args, std::index_sequence<I...>)
+	{
+		static_assert(optionals_trail<Params...>(), "optional parameters must come last");
+		constexpr int required = required_count<Params...>();
+		constexpr int most = sizeof...(Params);
+		if (argCount < required || argCount > most)
+		{
+			auto expected = required == most ? std::to_string(most) : std::to_string(required) + " to " + std::to_string(most);
+			throw NativeError("Expected " + expected + " arguments but got " + std::to_string(argCount) + ".");
+		}
+		// unpacked into a tuple first so the checks run left to right
+		std::tuple<Params...> unpacked{unpack<Params>(args, argCount, I)...};
+		auto invoke = [&vm](auto &&...params) -> decltype(auto)
+		{
+			if constexpr (WithVM)
+				return Fn(vm, std::forward<decltype(params)>(params)...);
+			else
+			{
+				(void)vm;
+				return Fn(std::forward<decltype(params)>(params)...);
+			}
+		};
+		if constexpr (std::is_void_v<R>)
+		{
+			std::apply(invoke, std::move(unpacked));
+			return Value();
+		}
+		else
+			return box(std::apply(invoke, std::move(unpacked)));
+	}
+
+	template <auto Fn, typename F = decltype(Fn)>
+	struct Thunk;
+
+	template <auto Fn, typename R, typename... Params>
+	struct Thunk<Fn, R (*)(VM &, Params...)>
+	{
+		static Value call(VM &vm, int argCount, Value *args)
+		{
+			return binding::call<Fn, true, R, Params...>(vm, argCount, args, std::index_sequence_for<Params...>{});
+		}
+	};
+
+	template <auto Fn, typename R, typename... Params>
+	struct Thunk<Fn, R (*)(Params...)>
+	{
+		static Value call(VM &vm, int argCount, Value *args)
+		{
+			return binding::call<Fn, false, R, Params...>(vm, argCount, args, std::index_sequence_for<Params...>{});
+		}
+	};
+}
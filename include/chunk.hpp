@@ -1,4 +1,5 @@
 #pragma once
+#include <unordered_map>
 #include <vector>
 #include <ostream>
 #include "opcode.hpp"
@@ -8,6 +9,26 @@
 std::ostream &operator<<(std::ostream &os, Opcode op);
 std::ostream &operator<<(std::ostream &os, std::vector<Value, Allocator<Value>> &values);
 
+// Jump targets of one switch statement as bytecode offsets. Dense int labels are
+// looked up in dense_ by OP_TABLE_SWITCH, others in cases_ by OP_HASH_SWITCH. String
+// labels are interned, so they compare by address like Json keys.
+struct SwitchTable
+{
+    int low_ = 0; // the label of dense_[0]
+    std::vector<int> dense_;
+    std::unordered_map<Value, int> cases_;
+    int default_ = 0;
+};
+
+// [begin_, end_) holds the body of a function inlined by the compiler, so a runtime
+// error raised there can name it. function_ is its constant index
+struct InlinedCall
+{
+    int begin_;
+    int end_;
+    uint8_t function_;
+};
+
 class Compiler;
 struct Chunk
 {
@@ -15,6 +36,8 @@ struct Chunk
 
     std::vector<Value, Allocator<Value>> constants_;
     std::vector<int> lines_;
+    std::vector<SwitchTable> switches_;
+    std::vector<InlinedCall> inlined_;
 
     friend std::ostream &operator<<(std::ostream &os, const Chunk &chunk);
 };
@@ -9,5 +9,10 @@ enum InterpretResult
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_MAX)
 
+// the test build turns both off, so scripts print only their own output
+#ifndef NO_DEBUG_MODE
 #define DEBUG_MODE
-#define STRESS_TEST 
+#endif
+#ifndef NO_STRESS_TEST
+#define STRESS_TEST
+#endif
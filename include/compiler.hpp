@@ -14,6 +14,7 @@ struct Local
     Token name_;
     int depth_ = -1;
     bool is_captured_ = false;
+    bool is_referenced_ = false; // lets a range loop skip storing a variable its body never uses
 };
 
 enum FunctionType
@@ -35,6 +36,13 @@ struct LoopCompiler {
     std::vector<BreakAndContinue> offsets_;
 };
 
+// a callee's body rewritten to run in its caller
+struct InlineBody {
+    std::vector<uint8_t> code_;
+    std::vector<std::pair<size_t, Value>> constants_; // operand offset in code_, constant
+    int slide_ = 0; // values under the result to drop
+};
+
 struct ClassCompiler {
     std::unique_ptr<ClassCompiler> enclosing_ = nullptr;
 	Token name_;
@@ -50,12 +58,21 @@ struct Compiler
     std::array<Local, UINT8_MAX> locals_;
     int local_count_ = 0;
     int scope_depth_ = 0;
+    // offsets call() needs to turn a property or super load it calls into an invoke
+    int property_get_ = -1;
+    int global_get_ = -1;
+    int call_ = -1; // the last OP_CALL or OP_INVOKE, for return_statement
+    int super_load_ = -1;
+    int super_get_ = -1;
+    int jump_target_ = -1; // where the last patched forward jump lands
 };
 
 struct Complication
 {
     Complication(VM &vm);
     ObjFunction *compile(const std::string_view &source);
+    // drops the state of a compile an exception left halfway
+    void reset();
     Chunk *current_chunk();
 
     auto end_compiler() -> std::pair<ObjFunction*, std::unique_ptr<Compiler>>;
@@ -80,6 +97,8 @@ struct Complication
     void get_or_set(bool canAssign);
     uint8_t argument_list();
     void call(bool canAssign);
+    bool inline_body(ObjFunction *callee, bool method, InlineBody &body);
+    void emit_inline(ObjFunction *callee, uint8_t argCount, InlineBody &body);
     void literal(bool canAssign);
     void string(bool canAssign);
     void variable(bool canAssign);
@@ -89,18 +108,24 @@ struct Complication
     void block();
     void while_statement();
     void for_statement();
+    void for_in_statement(const Token &name);
+    void for_range_statement(const Token &name);
     void emit_loop(int loopStart);
     void return_statement();
     void print_statement();
     void if_statement();
+    void switch_statement();
+    Value case_label();
     void expression_statement();
     void var_declaration();
-    void function(FunctionType type);
+    void var_initializer(uint8_t global);
+    ObjFunction *function(FunctionType type);
     void method();
     void name_variable(const Token& name, bool canAssign);
     uint8_t parse_variable(const std::string_view &message);
     uint8_t identifier_constant(const Token& token);
     int emit_jump(Opcode instruction);
+    void truncate_chunk(int size);
     void patch_jump(int offset);
     void patch_offset(int start, int end);
     bool check(TokenType type);
@@ -155,6 +180,10 @@ struct Complication
     VM &vm_;
 
     std::unordered_set<ObjString*> global_table_; 
+    // functions declared so far in this compile, by global or method name. a method
+    // name two classes define differently maps to nullptr
+    std::unordered_map<std::string_view, ObjFunction *> inline_functions_;
+    std::unordered_map<std::string_view, ObjFunction *> inline_methods_;
     std::unordered_map<TokenType, const Parser::ParseRule> get_rule_;
     std::unique_ptr<LoopCompiler> current_loop_ = nullptr;
 };
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+constexpr size_t ARENA_SIZE = 256 * 1024;
+constexpr size_t GRANULE = 16;
+constexpr size_t ARENA_WORDS = ARENA_SIZE / GRANULE / 64;
+constexpr size_t MAX_SLOT_SIZE = 4096; // larger objects get an arena of their own
+
+// Objects are carved out of ARENA_SIZE aligned blocks, so the header of the block
+// holding an object is found by masking its address. Mark and live bits sit in that
+// header, one bit per granule, which keeps marking from writing to object memory.
+struct Arena
+{
+	uint64_t marks_[ARENA_WORDS];
+	uint64_t live_[ARENA_WORDS]; // set for registered objects, only touched by the mutator
+	Arena *prev_ = nullptr;
+	Arena *next_ = nullptr;
+	size_t slot_size_;	// 0 for a large object arena
+	size_t slot_count_;
+	size_t large_size_ = 0; // object size of a large object arena
+	size_t used_ = 0; // slots handed out and not yet returned
+	char *bump_;	  // first slot never handed out
+	void *free_ = nullptr;
+	bool evacuating_ = false; // no new objects are placed here while compacting
+
+	static Arena *of(const void *p) noexcept
+	{
+		return reinterpret_cast<Arena *>(reinterpret_cast<uintptr_t>(p) & ~(ARENA_SIZE - 1));
+	}
+	static size_t index_of(const void *p) noexcept
+	{
+		return (reinterpret_cast<uintptr_t>(p) & (ARENA_SIZE - 1)) / GRANULE;
+	}
+	char *begin() noexcept;
+	char *end() noexcept { return reinterpret_cast<char *>(this) + ARENA_SIZE; }
+	bool is_large() const noexcept { return slot_size_ == 0; }
+	size_t live_count() const noexcept;
+};
+
+struct Heap
+{
+	Heap();
+	~Heap();
+
+	void *allocate(size_t size);
+	void deallocate(void *p, size_t size);
+
+	static bool mark(const void *p) noexcept; // false if it was marked already
+	static bool is_marked(const void *p) noexcept;
+	static void set_live(const void *p) noexcept;
+	static void clear_live(const void *p) noexcept;
+
+	void clear_marks();
+
+	// share of small arena slot space held by registered objects
+	double occupancy();
+	// slot bytes held by registered objects, large ones included
+	size_t live_bytes();
+	// flags sparse arenas so allocation avoids them, returns them for evacuation
+	std::vector<Arena *> begin_evacuation(double threshold);
+	void end_evacuation();
+
+	// visit every registered object whose mark bit is clear, clearing its live bit
+	template <typename Fn>
+	void for_each_unmarked(Fn &&fn);
+
+	// visit every registered object
+	template <typename Fn>
+	void for_each_live(Fn &&fn);
+
+	std::mutex mutex_; // the sweeper thread frees into the heap
+	std::atomic<size_t> arena_count_{0}; // the sweeper releases arenas too
+
+private:
+	struct SizeClass
+	{
+		Arena *current_ = nullptr;
+		std::vector<Arena *> partial_; // arenas with free slots besides current_
+	};
+
+	static size_t class_of(size_t size) noexcept;
+	static size_t slot_size_of(size_t cls) noexcept;
+	Arena *new_arena(size_t slot_size, size_t bytes);
+	void release(Arena *arena);
+
+	std::vector<SizeClass> classes_;
+	Arena *arenas_ = nullptr;
+};
+
+template <typename Fn>
+void Heap::for_each_unmarked(Fn &&fn)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		for (size_t w = 0; w < ARENA_WORDS; w++)
+		{
+			auto dead = arena->live_[w] & ~arena->marks_[w];
+			arena->live_[w] &= ~dead;
+			while (dead != 0)
+			{
+				auto bit = __builtin_ctzll(dead);
+				dead &= dead - 1;
+				fn(reinterpret_cast<char *>(arena) + (w * 64 + bit) * GRANULE);
+			}
+		}
+}
+
+template <typename Fn>
+void Heap::for_each_live(Fn &&fn)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		for (size_t w = 0; w < ARENA_WORDS; w++)
+		{
+			auto live = arena->live_[w];
+			while (live != 0)
+			{
+				auto bit = __builtin_ctzll(live);
+				live &= live - 1;
+				fn(reinterpret_cast<char *>(arena) + (w * 64 + bit) * GRANULE);
+			}
+		}
+}
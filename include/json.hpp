@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "value.hpp"
+
+class VM;
+
+// Parsing runs in two stages, as in simdjson. The first classifies the text 64 bytes
+// at a time and lists the offsets of the structural characters, that is brackets,
+// colons, commas, opening quotes and the first byte of every other scalar. The second
+// walks that list once and builds ObjJson and ObjArray with their final sizes.
+// Numbers must be 32 bit integers, like every number in the language.
+//
+// Stringifying walks the value with an explicit stack, so nesting depth is only
+// bounded by memory.
+namespace json
+{
+	// offsets of the structural characters, throws NativeError on an unterminated string
+	std::vector<uint32_t> structural_index(std::string_view text);
+
+	// throws NativeError with the offset of the first error
+	Value parse(std::string_view text, VM &vm);
+
+	// appends value as JSON to out. with fd set, out is written to fd and emptied every
+	// FLUSH_BYTES and at the end. throws NativeError on values JSON cannot hold and cycles
+	template <typename Buffer>
+	void stringify(const Value &value, Buffer &out, int fd = -1);
+
+	constexpr size_t FLUSH_BYTES = 64 * 1024;
+}
@@ -1,16 +1,30 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <deque>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "table.hpp"
 #include "obj.hpp"
+#include "heap.hpp"
 #include "common.hpp"
 
 struct ObjString;
+struct ObjJson;
 struct VM;
+struct Snapshot;
+struct AllocProfiler;
 
 struct GC;
 struct Obj;
@@ -44,23 +58,136 @@ struct Allocator : AllocBase
 	void deallocate(T *p, std::size_t n);
 };
 
+// stateless, any two can free each other's memory
+template <typename T, typename U>
+bool operator==(const Allocator<T> &, const Allocator<U> &) noexcept { return true; }
+template <typename T, typename U>
+bool operator!=(const Allocator<T> &, const Allocator<U> &) noexcept { return false; }
+
+// Obj themselves live in GC::heap_ so their mark bits can sit in a side table
+void *allocate_obj(std::size_t size);
+void deallocate_obj(void *p, std::size_t size);
+
+// Heap sizes are in bytes. Throughput oriented jobs want a large initial heap and
+// growth factor, latency sensitive ones a small minimum interval and a soft limit.
+struct GCConfig
+{
+	size_t initial_heap_ = 1024 * 1024; // first collection happens past this
+	double growth_factor_ = 2.0;		// next threshold is the live heap times this
+	size_t min_interval_ = 0;			// bytes allocated between two collections at least
+	size_t soft_limit_ = 0;				// past it collections come early and compact, 0 is none
+	size_t max_heap_ = 0;				// exceeding it after a collection is fatal, 0 is none
+	bool compact_ = true;
+	bool dump_stats_ = false; // print GCStats to stderr when the VM goes away
+	std::string snapshot_path_; // write a heap snapshot graph here when the VM goes away
+	size_t alloc_profile_ = 0;	// sample allocation sites every this many bytes, 0 is off
+
+	// LOX_GC_INITIAL_HEAP, LOX_GC_GROWTH, LOX_GC_MIN_INTERVAL, LOX_GC_SOFT_LIMIT,
+	// LOX_GC_MAX_HEAP, LOX_GC_COMPACT, LOX_GC_STATS, LOX_GC_SNAPSHOT and LOX_GC_ALLOC_PROFILE
+	// applied over the defaults
+	static GCConfig from_env();
+	// takes one --gc-* command line flag, false if it is not one
+	bool parse_flag(std::string_view flag);
+	static std::optional<size_t> parse_size(std::string_view text); // accepts K, M and G suffixes
+};
+
+enum class GCCause
+{
+	Allocation, // crossed the threshold from growth factor and minimum interval
+	SoftLimit,	// crossed a threshold lowered by the soft limit
+	Explicit,	// gc() called from a script
+	Count
+};
+
+constexpr size_t OBJ_TYPE_COUNT = static_cast<size_t>(ObjType::StringBuilder) + 1;
+constexpr size_t PAUSE_BUCKETS = 24; // bucket i holds pauses under 2^i microseconds
+
+// totals since the VM started, read through gcStats() or dumped with --gc-stats
+struct GCStats
+{
+	using Duration = std::chrono::steady_clock::duration;
+
+	size_t collections_ = 0;
+	std::array<size_t, static_cast<size_t>(GCCause::Count)> causes_{};
+	Duration roots_{}, trace_{}, strings_{}, sweep_{};
+	Duration total_pause_{}, max_pause_{}, last_pause_{};
+	std::array<size_t, PAUSE_BUCKETS> pauses_{};
+	std::array<size_t, OBJ_TYPE_COUNT> freed_objects_{};
+	std::array<size_t, OBJ_TYPE_COUNT> freed_bytes_{}; // object slots, not what they own
+	size_t live_bytes_ = 0;		// after the last collection
+	size_t live_objects_ = 0;
+	size_t compactions_ = 0;
+	size_t moved_objects_ = 0;
+};
+
+struct GrayItem
+{
+	Obj *obj_ = nullptr;
+	// a non-empty [begin_, end_) is one slice of a large array or json
+	size_t begin_ = 0;
+	size_t end_ = 0;
+};
+
+// thrown from an allocation whose collection leaves more than max_heap_ live, the VM
+// reports it as a runtime error of the instruction that allocated
+struct OutOfMemory : std::runtime_error
+{
+	using std::runtime_error::runtime_error;
+};
+
+// every marking thread owns one, idle threads steal from the others
+struct MarkWorker
+{
+	std::mutex mutex_;
+	std::vector<GrayItem> stack_;
+};
+
 struct GC
 {
-	std::unique_ptr<Obj, ObjDeleter> objects_ = nullptr;
-	std::set<ObjString *, std::less<ObjString *>, Allocator<ObjString *>> strings_;
-	std::deque<Obj *> gray_stack_;
+	Heap heap_;
+	StringTable strings_;
+	size_t object_count_ = 0;
 
-	size_t bytes_allocated_ = 0;
-	size_t next_gc_ = 1024 * 1024;
+	// decremented by the sweeper thread as it frees dead objects
+	std::atomic<size_t> bytes_allocated_{0};
+	size_t next_gc_;
+	GCConfig config_;
 
 	VM &vm_;
 
-	explicit GC(VM &vm) noexcept
-		: vm_(vm)
-	{
-	}
+	GC(VM &vm, const GCConfig &config);
+	~GC();
 
-	void collect();
+	void collect(GCCause cause = GCCause::Allocation);
+	// embedding api, retunes a running collector
+	void configure(const GCConfig &config);
+	bool is_marked(const Obj *ptr) const noexcept { return Heap::is_marked(ptr); }
+
+	// a collection that leaves the arenas sparse asks for compaction, which the VM
+	// runs at its next safe point since C++ frames may hold raw pointers until then
+	bool compact_requested_ = false;
+	void compact();
+
+	GCStats stats_;
+	ObjJson *stats_json();
+	void dump_stats(std::ostream &os) const;
+
+	// walks everything reachable from the roots, see snapshot.cpp; the collapsed
+	// stack graph goes to graph_path when it is given
+	ObjJson *heap_snapshot(const char *graph_path = nullptr);
+	void dump_snapshot(std::ostream &os, const char *graph_path);
+	// the --gc-stats, --gc-snapshot and --gc-alloc-profile reports, run by ~VM while the roots are intact
+	void report_exit();
+
+	std::unique_ptr<AllocProfiler> profiler_; // null unless alloc_profile_ is set
+
+	// building Json from C++, the parent must be rooted or pinned
+	void json_set(ObjJson *json, std::string_view key, const Value &value);
+	ObjJson *json_child(ObjJson *json, std::string_view key);
+
+	// pinned objects are roots that compaction leaves in place
+	void pin(Obj *ptr);
+	void unpin(Obj *ptr);
 
 private:
 	void mark_roots();
@@ -71,14 +198,80 @@ private:
 	void mark_value(const Value &value);
 
 	void trace_references();
+	void drain(MarkWorker &worker);
+	void push_gray(const GrayItem &item);
+	bool pop_gray(MarkWorker &worker, GrayItem &item);
+	bool steal_gray(MarkWorker &thief, GrayItem &item);
 	void blacken_object(Obj *ptr);
+	void blacken_slice(const GrayItem &item);
 	void remove_white_string() noexcept;
 
 	void sweep();
 
+	void wait_for_sweeper();
+	Obj *relocate(Obj *ptr);
+	template <typename T>
+	T *move_obj(T *from);
+	template <typename T>
+	void fix(T *&ptr);
+	void fix_value(Value &value);
+	void fix_table(Table &table);
+	void fix_bound_methods(BoundMethods &bound_methods);
+	void fix_fields(Obj *ptr);
+
+	std::unordered_map<Obj *, size_t> pins_;
+	std::unordered_map<Obj *, Obj *> forward_; // old address to new while compacting
+	bool compacting_ = false;
+	bool soft_limited_ = false; // next_gc_ was lowered by the soft limit
+
+	void take_snapshot(Snapshot &snapshot, bool graph);
+
+	// dead objects are unlinked on the mutator and destroyed by sweeper_
+	void sweeper_loop();
+	void hand_off(std::vector<Obj *> &&garbage);
+
+	std::mutex sweep_mutex_;
+	std::condition_variable sweep_cv_;
+	std::vector<std::vector<Obj *>> sweep_queue_;
+	std::condition_variable sweep_idle_cv_;
+	bool sweeper_busy_ = false;
+	bool sweeper_stop_ = false;
+	std::thread sweeper_;
+
+	// marker threads only join in once the heap is large enough to pay for the wakeup
+	void marker_loop(MarkWorker *worker);
+
+	std::vector<std::unique_ptr<MarkWorker>> mark_workers_; // [0] belongs to the mutator
+	std::atomic<size_t> gray_count_{0};
+	std::mutex mark_mutex_;
+	std::condition_variable mark_cv_;
+	std::condition_variable mark_done_cv_;
+	size_t mark_generation_ = 0;
+	size_t markers_done_ = 0;
+	bool markers_stop_ = false;
+	std::vector<std::thread> markers_;
+	inline static thread_local MarkWorker *local_worker_ = nullptr;
+
 public:
-	ObjString *find_string(const std::string_view &str) const;
+	ObjString *find_string(std::string_view str, uint32_t hash) const;
+
+};
+
+// keeps an object alive and in place while native code holds its address
+template <typename T>
+struct Pinned
+{
+	Pinned(GC &gc, T *ptr) : gc_(gc), ptr_(ptr) { gc_.pin(ptr_); }
+	~Pinned() { gc_.unpin(ptr_); }
+	Pinned(const Pinned &) = delete;
+	Pinned &operator=(const Pinned &) = delete;
 
+	T *get() const noexcept { return ptr_; }
+	T *operator->() const noexcept { return ptr_; }
+
+private:
+	GC &gc_;
+	T *ptr_;
 };
 
 template <typename T>
@@ -91,11 +284,18 @@ T *Allocator<T>::allocate(std::size_t n)
 	std::cout << "allocate: " << alloc_size << std::endl;
 #endif
 	gc->bytes_allocated_ += alloc_size;
+	try
+	{
 #ifndef STRESS_TEST
-	if (gc->bytes_allocated_ > gc->next_gc_)
+		if (gc->bytes_allocated_ > gc->next_gc_)
 #endif
-		gc->collect();
-	
+			gc->collect();
+	}
+	catch (const OutOfMemory &)
+	{
+		deallocate(p, n);
+		throw;
+	}
 
 	return p;
 }
@@ -1,36 +1,244 @@
 #pragma once
 #include "value.hpp"
+#include "json.hpp"
+#include "object.hpp"
+#include "objstring.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+#include "vm.hpp"
+#include <algorithm>
 #include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
 
+// natives are bound with VM::define_native<&Native::fn>, which checks the arguments
+// against the parameter types. errors are thrown as NativeError
 class Native {
     public:
-    static Value clock(int argCount, Value* args) {
+    static int clock() {
         auto tp = std::chrono::high_resolution_clock::now().time_since_epoch();
 	    return static_cast<int>(std::chrono::duration<double>(tp).count());
     }
-    static Value push(int argCount, Value* args) {
-        args[0].as_obj<ObjArray>()->values_.push_back(args[1]);
-        return Value();
-    }
-    static Value pop(int argCount, Value* args) {
-        auto array = args[0].as_obj<ObjArray>();
-        auto ret = array->values_.back();
-        array->values_.pop_back();
-        return ret;
-    }
-    static Value erase(int argCount, Value* args) {
-        auto value = args[0].as_obj<ObjArray>();
-        auto index = args[1].as<int>();
-        auto& array = value->values_;
-        auto ret = array.at(index);
-        array.erase(index + array.begin());
-        return ret;
-    }
-    static Value insert(int argCount, Value* args) {
-        auto& array = args[0].as_obj<ObjArray>()->values_;
-        auto index = args[1].as<int>();
-        auto value = args[2];
-        array.insert(index + array.begin(), value);
-        return Value();
-    }
-};
\ No newline at end of file
+    static void push(ObjArray* array, Value value) {
+        array->push(value);
+    }
+    static Value pop(ObjArray* array) {
+        if (array->size() == 0)
+            throw NativeError("Cannot pop an empty array.");
+        return array->pop();
+    }
+    static Value erase(ObjArray* array, int index) {
+        if (index < 0 || static_cast<size_t>(index) >= array->size())
+            throw NativeError("Index is out of range.");
+        return array->erase(index);
+    }
+    static void insert(ObjArray* array, int index, Value value) {
+        if (index < 0 || static_cast<size_t>(index) > array->size())
+            throw NativeError("Index is out of range.");
+        array->insert(index, value);
+    }
+
+    // the elements as ints, a packed array lends its own buffer
+    static const int* ints_of(const ObjArray* array, std::vector<int>& scratch) {
+        if (array->packed_)
+            return array->ints_.data();
+        scratch.reserve(array->values_.size());
+        for (auto& value : array->values_) {
+            if (!value.is_number())
+                throw NativeError("Expected an array of numbers.");
+            scratch.push_back(value.as<int>());
+        }
+        return scratch.data();
+    }
+    static int sum(ObjArray* array) {
+        std::vector<int> scratch;
+        return kernels().sum_(ints_of(array, scratch), array->size());
+    }
+    static Value min(ObjArray* array) {
+        std::vector<int> scratch;
+        if (array->size() == 0)
+            return Value();
+        return kernels().min_(ints_of(array, scratch), array->size());
+    }
+    static Value max(ObjArray* array) {
+        std::vector<int> scratch;
+        if (array->size() == 0)
+            return Value();
+        return kernels().max_(ints_of(array, scratch), array->size());
+    }
+    static int dot(ObjArray* a, ObjArray* b) {
+        std::vector<int> scratch_a, scratch_b;
+        if (a->size() != b->size())
+            throw NativeError("Expected arrays of the same length.");
+        return kernels().dot_(ints_of(a, scratch_a), ints_of(b, scratch_b), a->size());
+    }
+    static ObjArray* fill(ObjArray* array, Value value) {
+        if (array->packed_ && value.is_number())
+            kernels().fill_(array->ints_.data(), array->ints_.size(), value.as<int>());
+        else {
+            array->unpack();
+            std::fill(array->values_.begin(), array->values_.end(), value);
+        }
+        return array;
+    }
+    static int index_of(ObjArray* array, Value value) {
+        size_t index;
+        if (array->packed_) {
+            if (!value.is_number())
+                return -1;
+            index = kernels().index_of_(array->ints_.data(), array->ints_.size(), value.as<int>());
+        }
+        else
+            index = std::find(array->values_.begin(), array->values_.end(), value) - array->values_.begin();
+        return index == array->size() ? -1 : static_cast<int>(index);
+    }
+    static ObjArray* add(VM& vm, ObjArray* a, ObjArray* b) {
+        return vm.elementwise(a, b, kernels().add_);
+    }
+    static ObjArray* mul(VM& vm, ObjArray* a, ObjArray* b) {
+        return vm.elementwise(a, b, kernels().mul_);
+    }
+    static ObjArray* sort(VM& vm, ObjArray* array, std::optional<Value> cmp) {
+        return vm.sort_array(array, cmp);
+    }
+
+
+    // the callbacks below run through VM::call_closure. a result waits on the VM stack
+    // until it is stored, since storing it may collect
+    static ObjArray* map(VM& vm, ObjArray* array, Value fn) {
+        Pinned<ObjArray> result(vm.gc_, create_obj<ObjArray>(vm.gc_, 0));
+        for (size_t i = 0; i < array->size(); i++) {
+            vm.push(vm.call_closure(fn, {array->at(i)}));
+            result->push(vm.peek(0));
+            vm.pop();
+        }
+        return result.get();
+    }
+    static ObjArray* filter(VM& vm, ObjArray* array, Value fn) {
+        Pinned<ObjArray> result(vm.gc_, create_obj<ObjArray>(vm.gc_, 0));
+        for (size_t i = 0; i < array->size(); i++) {
+            vm.push(array->at(i));
+            if (!is_falsey(vm.call_closure(fn, {vm.peek(0)})))
+                result->push(vm.peek(0));
+            vm.pop();
+        }
+        return result.get();
+    }
+    // reduce(array, fn[, initial]) folds with fn(acc, element)
+    static Value reduce(VM& vm, ObjArray* array, Value fn, std::optional<Value> initial) {
+        size_t i = 0;
+        if (initial)
+            vm.push(*initial);
+        else if (array->size() > 0)
+            vm.push(array->at(i++));
+        else
+            return Value();
+        for (; i < array->size(); i++) {
+            auto acc = vm.call_closure(fn, {vm.peek(0), array->at(i)});
+            vm.pop();
+            vm.push(acc);
+        }
+        return vm.pop();
+    }
+    static void for_each(VM& vm, ObjArray* array, Value fn) {
+        for (size_t i = 0; i < array->size(); i++)
+            vm.call_closure(fn, {array->at(i)});
+    }
+
+    static ObjStringBuilder* string_builder(VM& vm) {
+        return create_obj<ObjStringBuilder>(vm.gc_);
+    }
+    // append(sb, a, b, ...) returns sb so calls can be chained. variadic, so bound untyped
+    static Value append(VM&, int argCount, Value* args) {
+        if (argCount < 1 || !args[0].is_obj_type<ObjStringBuilder>())
+            throw NativeError("Expected a string builder.");
+        auto builder = args[0].as_obj<ObjStringBuilder>();
+        for (int i = 1; i < argCount; i++)
+            builder->append(args[i]);
+        return args[0];
+    }
+    static ObjString* to_string(VM& vm, ObjStringBuilder* builder) {
+        return create_obj_string(std::string_view(builder->buffer_), vm);
+    }
+    // substr(s, start[, length]), clamped to s
+    static ObjString* substr(VM& vm, ObjString* str, int start, std::optional<int> length) {
+        int n = str->length_;
+        start = std::clamp(start, 0, n);
+        return create_slice(str, start, length ? std::clamp(*length, 0, n - start) : n - start, vm);
+    }
+    // slice(s, start[, end]), negative positions count from the end
+    static ObjString* slice(VM& vm, ObjString* str, int start, std::optional<int> end) {
+        int n = str->length_;
+        auto position = [n](int i) { return std::clamp(i < 0 ? i + n : i, 0, n); };
+        int from = position(start);
+        int to = end ? position(*end) : n;
+        return create_slice(str, from, std::max(to - from, 0), vm);
+    }
+    // split(s, sep) returns slices of s, an empty sep splits it into characters
+    static ObjArray* split(VM& vm, ObjString* str, ObjString* separator) {
+        auto text = str->text();
+        auto sep = separator->text();
+        size_t count = text.size();
+        if (!sep.empty()) {
+            count = 1;
+            for (auto at = text.find(sep); at != std::string_view::npos; at = text.find(sep, at + sep.size()))
+                count++;
+        }
+        Pinned<ObjArray> pieces(vm.gc_, create_obj<ObjArray>(vm.gc_, count));
+        size_t from = 0;
+        for (size_t i = 0; i < count; i++) {
+            auto at = sep.empty() ? i + 1 : std::min(text.find(sep, from), text.size());
+            pieces->values_[i] = create_slice(str, from, at - from, vm);
+            from = at + sep.size();
+        }
+        return pieces.get();
+    }
+
+    static Value json_parse(VM& vm, ObjString* text) {
+        return json::parse(text->text(), vm);
+    }
+
+    // jsonStringify(value[, out]) returns the text, or appends it to the string builder
+    // out and returns that, or writes it to stdout for 1 and stderr for 2
+    static Value json_stringify(VM& vm, Value value, std::optional<Value> out) {
+        if (!out) {
+            std::string text;
+            json::stringify(value, text);
+            return Value(create_obj_string(std::string_view(text), vm));
+        }
+        if (out->is_obj_type<ObjStringBuilder>()) {
+            json::stringify(value, out->as_obj<ObjStringBuilder>()->buffer_);
+            return *out;
+        }
+        if (out->is_number() && (out->as<int>() == 1 || out->as<int>() == 2)) {
+            // what print buffered goes first
+            std::cout.flush();
+            std::string buffer;
+            buffer.reserve(json::FLUSH_BYTES);
+            json::stringify(value, buffer, out->as<int>());
+            return Value();
+        }
+        throw NativeError("Expected a string builder, 1 for stdout or 2 for stderr as argument 2.");
+    }
+
+    // an explicit request also defragments, at the next safe point
+    static void gc(VM& vm) {
+        vm.gc_.collect(GCCause::Explicit);
+        vm.gc_.compact_requested_ = vm.gc_.config_.compact_;
+    }
+    static ObjJson* gc_stats(VM& vm) {
+        return vm.gc_.stats_json();
+    }
+    // heapSnapshot(path) also writes the object graph as collapsed stacks
+    static ObjJson* heap_snapshot(VM& vm, std::optional<ObjString*> path) {
+        if (path)
+            return vm.gc_.heap_snapshot(std::string((*path)->text()).c_str());
+        return vm.gc_.heap_snapshot();
+    }
+    static Value alloc_profile(VM& vm) {
+        if (vm.gc_.profiler_ == nullptr)
+            return Value();
+        return vm.gc_.profiler_->top_sites();
+    }
+};
@@ -1,9 +1,9 @@
 #pragma once
 
-#include <functional>
+#include <cstdint>
 #include <memory>
 
-enum class ObjType
+enum class ObjType : uint8_t
 {
 	BoundMethod,
 	Class,
@@ -15,16 +15,16 @@ enum class ObjType
 	Upvalue,
 	Array,
 	Json,
-	Coroutine
+	Coroutine,
+	StringBuilder
 };
 
 struct Obj;
-using ObjDeleter = std::function<void(Obj*)>;
+using ObjDeleter = void (*)(Obj *);
+// mark and live bits are kept in the arena header, see heap.hpp
 struct Obj
 {
 	ObjType type_;
-	bool is_marked_ = false;
-	std::unique_ptr<Obj, ObjDeleter> next_ = nullptr;
 
 	bool is_type(ObjType type) const
 	{
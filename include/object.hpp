@@ -6,16 +6,18 @@
 #include "chunk.hpp"
 #include "common.hpp"
 #include <functional>
+#include <stdexcept>
 #include <unordered_map>
 
 struct ObjString;
+struct ObjStringBuilder;
 struct ObjClosure;
 struct GC;
 struct Obj;
 
 struct CallFrame {
     ObjClosure* closure_ = nullptr;
-    uint8_t ip_ = 0;
+    int ip_ = 0;
     // Value* slots_ = nullptr;
     int slot_ = 0;
 
@@ -26,14 +28,17 @@ struct CallFrame {
 };
 
 void register_obj(std::unique_ptr<Obj, ObjDeleter> &&obj, GC &gc);
+void free_obj(Obj *obj);
 
 template <typename T>
-auto delete_obj(Allocator<T> &alloc, T *ptr)
+auto delete_obj(T *ptr)
 	-> typename std::enable_if_t<std::is_base_of_v<Obj, T>, void>
 {
+	static Allocator<T> a;
+
 	using AllocTraits = std::allocator_traits<Allocator<T>>;
-	AllocTraits::destroy(alloc, ptr);
-	AllocTraits::deallocate(alloc, ptr, 1);
+	AllocTraits::destroy(a, ptr);
+	deallocate_obj(ptr, sizeof(T));
 }
 
 struct ObjFunction : public Obj
@@ -48,7 +53,20 @@ struct ObjFunction : public Obj
 
 std::ostream &operator<<(std::ostream &os, const ObjFunction &f);
 
-using NativeFn = std::function<Value(int argCount, Value *args)>;
+class VM;
+// a plain pointer, the call is not type erased. typed natives go through binding.hpp
+using NativeFn = Value (*)(VM &vm, int argCount, Value *args);
+
+// thrown by a native, the VM reports it as a runtime error of the call
+struct NativeError : std::runtime_error
+{
+	using std::runtime_error::runtime_error;
+};
+
+// unwinds a native whose callback already reported a runtime error
+struct ScriptError
+{
+};
 
 struct ObjNative : public Obj
 {
@@ -94,7 +112,7 @@ std::ostream &operator<<(std::ostream &os, const ObjClosure &s);
 
 struct ObjClass : public Obj
 {
-	ObjString *const name_;
+	ObjString *name_;
 	Table methods_;
 
 	ObjClass(ObjString *name)
@@ -106,8 +124,10 @@ std::ostream &operator<<(std::ostream &os, const ObjClass &c);
 
 struct ObjInstance : public Obj
 {
-	ObjClass *const objClass_;
+	ObjClass *objClass_;
 	Table fields_;
+	// methods bound to this instance that escaped, so binding again reuses them
+	BoundMethods bound_methods_;
 
 	ObjInstance(ObjClass *objClass)
 		: Obj(ObjType::Instance), objClass_(objClass)
@@ -116,22 +136,99 @@ struct ObjInstance : public Obj
 };
 std::ostream &operator<<(std::ostream &os, const ObjInstance &ins);
 
+// while every element is an int the array stays packed in ints_, the first
+// store of anything else moves the elements to values_ for good
 struct ObjArray : public Obj
 {
 	std::vector<Value, Allocator<Value>> values_;
+	std::vector<int, Allocator<int>> ints_;
+	bool packed_;
+
 	ObjArray(int size)
-		: Obj(ObjType::Array), values_(size)
+		: Obj(ObjType::Array), values_(size), packed_(size == 0)
 	{
 	}
+	// an array literal, packed when the elements are all ints
+	ObjArray(const Value *first, int count);
+
+	size_t size() const { return packed_ ? ints_.size() : values_.size(); }
+	Value at(size_t index) const
+	{
+		return packed_ ? Value(ints_.at(index)) : values_.at(index);
+	}
+	void set(size_t index, const Value &value)
+	{
+		if (packed_ && value.is_number())
+			ints_.at(index) = value.as<int>();
+		else
+		{
+			unpack();
+			values_.at(index) = value;
+		}
+	}
+	void push(const Value &value);
+	Value pop();
+	void insert(size_t index, const Value &value);
+	Value erase(size_t index);
+	// the caller keeps the array reachable, boxing the ints may collect
+	void unpack();
+	// back to ints_ when every element is one, same caveat
+	void pack();
 };
 std::ostream &operator<<(std::ostream &os, const ObjArray &arr);
 
+// Insertion ordered, laid out like CPython's dict: entries are appended to a dense
+// array and a power of two sized index of entry numbers is probed linearly. Keys are
+// hashed by address, so strings must be interned and moving keys needs rehash().
+class JsonMap
+{
+public:
+	struct Entry
+	{
+		Value key_;
+		Value value_;
+	};
+	using Entries = std::vector<Entry, Allocator<Entry>>;
+	using iterator = Entries::iterator;
+	using const_iterator = Entries::const_iterator;
+
+	size_t size() const noexcept { return entries_.size(); }
+	size_t capacity() const noexcept { return entries_.capacity(); }
+	size_t index_size() const noexcept { return index_.size(); }
+	iterator begin() noexcept { return entries_.begin(); }
+	iterator end() noexcept { return entries_.end(); }
+	const_iterator begin() const noexcept { return entries_.begin(); }
+	const_iterator end() const noexcept { return entries_.end(); }
+
+	// null when absent
+	Value *find(const Value &key);
+	// a new key is appended with nil, growing may collect
+	Value &operator[](const Value &key);
+	void insert_or_assign(const Value &key, const Value &value) { (*this)[key] = value; }
+	void reserve(size_t count);
+	// refills the index after the keys moved, without allocating
+	void rehash();
+
+private:
+	static constexpr int32_t EMPTY = -1;
+	static constexpr size_t MIN_INDEX = 8;
+
+	// the slot holding key's entry, or the empty one where it would go
+	size_t probe(const Value &key) const;
+	void resize_index(size_t slots);
+
+	Entries entries_;
+	std::vector<int32_t, Allocator<int32_t>> index_;
+};
+
 struct ObjJson : public Obj
 {
-	std::unordered_map<Value, Value, std::hash<Value>, std::equal_to<Value>, Allocator<std::pair<const Value, Value>>> kv_;
-	ObjJson()
+	JsonMap kv_;
+	// reserved before the object is registered, so no collection can free it meanwhile
+	explicit ObjJson(size_t capacity = 0)
 		: Obj(ObjType::Json)
 	{
+		kv_.reserve(capacity);
 	}
 };
 std::ostream &operator<<(std::ostream &os, const ObjJson &json);
@@ -139,7 +236,7 @@ std::ostream &operator<<(std::ostream &os, const ObjJson &json);
 struct ObjBoundMethod : public Obj
 {
 	Value receiver_;
-	ObjClosure *const method_;
+	ObjClosure *method_;
 
 	ObjBoundMethod(const Value& receiver, ObjClosure *method)
 		: Obj(ObjType::BoundMethod), receiver_(receiver), method_(method)
@@ -175,15 +272,10 @@ auto alloc_unique_obj(Args &&...args)
 	static Allocator<T> a;
 
 	using AllocTraits = std::allocator_traits<Allocator<T>>;
-	auto p = AllocTraits::allocate(a, 1);
+	auto p = static_cast<T *>(allocate_obj(sizeof(T)));
 	AllocTraits::construct(a, p, std::forward<Args>(args)...);
 
-	auto deleter = [](Obj *ptr)
-	{
-		delete_obj(a, static_cast<T *>(ptr));
-	};
-
-	return {p, deleter};
+	return {p, free_obj};
 }
 
 template <typename T, typename... Args>
@@ -223,14 +315,13 @@ constexpr auto objtype_of()
 		return ObjType::Json;
 	else if constexpr (std::is_same_v<T, ObjCoroutine>)
 		return ObjType::Coroutine;
+	else if constexpr (std::is_same_v<T, ObjStringBuilder>)
+		return ObjType::StringBuilder;
 }
 
-template <typename T>
-constexpr auto nameof()
-	-> typename std::enable_if_t<std::is_base_of_v<Obj, T> && !std::is_same_v<Obj, T>, std::string_view>
+constexpr std::string_view nameof(ObjType type)
 {
-
-	switch (objtype_of<T>())
+	switch (type)
 	{
 	case ObjType::BoundMethod:
 		return "bound method";
@@ -254,9 +345,25 @@ constexpr auto nameof()
 		return "json";
 	case ObjType::Coroutine:
 		return "coroutine";
+	case ObjType::StringBuilder:
+		return "string builder";
 	default:
 		return "unknown type";
 	}
 }
 
+template <typename T>
+constexpr auto nameof()
+	-> typename std::enable_if_t<std::is_base_of_v<Obj, T> && !std::is_same_v<Obj, T>, std::string_view>
+{
+	return nameof(objtype_of<T>());
+}
+
+// bytes of the object's own slot
+size_t obj_size(ObjType type);
+// strings carry their bytes, so their size depends on the object
+size_t obj_size(const Obj *obj);
+// obj_size plus the buffers the object owns, an estimate for node based containers
+size_t obj_footprint(const Obj *obj);
+
 std::ostream &operator<<(std::ostream &os, const Obj &obj);
\ No newline at end of file
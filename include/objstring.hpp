@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <string_view>
 #include "obj.hpp"
 #include "memory.hpp"
 #include "object.hpp"
@@ -7,8 +9,21 @@
 
 using clox_string = std::basic_string<char, std::char_traits<char>, Allocator<char>>;
 
+uint32_t hash_string(std::string_view text) noexcept;
+
+// the bytes follow the header in the same block, so a string is one allocation.
+// a slice is the exception, see ObjSlice
 struct ObjString : public Obj
 {
+    bool slice_ = false;
+    uint32_t length_;
+    uint32_t hash_;
+
+    // placement only, into a block of size_of(text.size()) bytes
+    ObjString(std::string_view text, uint32_t hash);
+    ObjString(const ObjString &) = delete;
+    ObjString &operator=(const ObjString &) = delete;
+
     bool operator==(const ObjString &str)
     {
         return text() == str.text();
@@ -17,14 +32,62 @@ struct ObjString : public Obj
     {
         return text() != str.text();
     }
-    clox_string content_;
 
-    explicit ObjString() : Obj(ObjType::String) {}
-    std::string_view text() const { return content_; }
+    static constexpr size_t size_of(size_t length) { return sizeof(ObjString) + length + 1; }
+    size_t size() const;
+    const char *chars() const;
+    std::string_view text() const { return {chars(), length_}; }
+
+protected:
+    ObjString(uint32_t length, uint32_t hash) : Obj(ObjType::String), slice_(true), length_(length), hash_(hash) {}
+};
+
+// a substring that points into its parent's bytes instead of copying them.
+// slices are not interned: equality compares text, and a slice used as a Json
+// key is swapped for the interned string first
+struct ObjSlice : public ObjString
+{
+    ObjString *parent_; // never a slice itself
+    uint32_t offset_;
+
+    ObjSlice(ObjString *parent, uint32_t offset, uint32_t length, uint32_t hash)
+        : ObjString(length, hash), parent_(parent), offset_(offset) {}
 };
 
+inline size_t ObjString::size() const
+{
+    return slice_ ? sizeof(ObjSlice) : size_of(length_);
+}
+
+inline const char *ObjString::chars() const
+{
+    if (slice_)
+    {
+        auto slice = static_cast<const ObjSlice *>(this);
+        return slice->parent_->chars() + slice->offset_;
+    }
+    return reinterpret_cast<const char *>(this + 1);
+}
+
+// [offset, offset + length) of str, which must lie inside it.
+// short pieces are copied and interned, they would not be smaller as a slice
+ObjString *create_slice(ObjString *str, size_t offset, size_t length, VM &vm);
+// the interned string with the same text, str itself unless it is a slice
+ObjString *intern(ObjString *str, VM &vm);
+
 std::ostream &operator<<(std::ostream &os, const ObjString &s);
 
+// mutable buffer for building text piece by piece, s = s + x copies s every time
+struct ObjStringBuilder : public Obj
+{
+    clox_string buffer_;
+
+    ObjStringBuilder() : Obj(ObjType::StringBuilder) {}
+    void append(const Value &value);
+};
+
+std::ostream &operator<<(std::ostream &os, const ObjStringBuilder &sb);
+
 clox_string operator+(const ObjString &lhs, const ObjString &rhs);
 bool operator==(const ObjString &lhs, const ObjString &rhs);
 
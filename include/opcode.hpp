@@ -48,6 +48,18 @@
     X(OP_CREATE_COROUTINE) \
     X(OP_YIELD_COROUTINE) \
     X(OP_RESUME_COROUTINE) \
+    X(OP_ITER_INIT) \
+    X(OP_ITER_NEXT) \
+    X(OP_RANGE_INIT) \
+    X(OP_FOR_RANGE) \
+    X(OP_FOR_COUNT) \
+    X(OP_TABLE_SWITCH) \
+    X(OP_HASH_SWITCH) \
+    X(OP_GUARD_CALL) \
+    X(OP_GUARD_INVOKE) \
+    X(OP_INLINE_RETURN) \
+    X(OP_TAIL_CALL) \
+    X(OP_TAIL_INVOKE) \
 
 enum Opcode
 {
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include "object.hpp"
+
+struct VM;
+struct ObjJson;
+
+// Samples object allocations every interval_ bytes and charges each sample to the
+// function and line that was executing. A sample taken on an allocation of size s
+// stands for max(interval_, s) bytes, so the totals estimate the real ones.
+struct AllocProfiler
+{
+	AllocProfiler(VM &vm, size_t interval) : vm_(vm), interval_(interval), countdown_(interval) {}
+
+	void record(const Obj *obj)
+	{
+		auto bytes = obj_footprint(obj);
+		if (countdown_ > bytes)
+		{
+			countdown_ -= bytes;
+			return;
+		}
+		countdown_ = interval_;
+		sample(obj, bytes);
+	}
+
+	ObjJson *top_sites();
+	void report(std::ostream &os) const;
+
+private:
+	struct Site
+	{
+		size_t samples_ = 0;
+		double bytes_ = 0;
+		double count_ = 0;
+	};
+
+	void sample(const Obj *obj, size_t bytes);
+	std::string current_site() const;
+
+	VM &vm_;
+	size_t interval_;
+	size_t countdown_;
+	std::map<std::pair<std::string, ObjType>, Site> sites_; // site and type of what it allocates
+};
@@ -34,6 +34,10 @@ public:
         check_keyword.insert({"elif", TOKEN_ELIF});
         check_keyword.insert({"var", TOKEN_VAR});
         check_keyword.insert({"for", TOKEN_FOR});
+        check_keyword.insert({"in", TOKEN_IN});
+        check_keyword.insert({"switch", TOKEN_SWITCH});
+        check_keyword.insert({"case", TOKEN_CASE});
+        check_keyword.insert({"default", TOKEN_DEFAULT});
         check_keyword.insert({"coroutine", TOKEN_COROUTINE});
         check_keyword.insert({"yield", TOKEN_YIELD});
         check_keyword.insert({"resume", TOKEN_RESUME});
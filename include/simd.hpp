@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+
+// Bulk kernels over packed int arrays. The widest instruction set the CPU
+// supports is picked once at startup: AVX2, SSE4.1, or plain loops.
+// Sums and products wrap around like the interpreter's own int arithmetic.
+struct Kernels
+{
+	const char *name_;
+	int (*sum_)(const int *a, size_t n);
+	int (*min_)(const int *a, size_t n); // n > 0
+	int (*max_)(const int *a, size_t n); // n > 0
+	int (*dot_)(const int *a, const int *b, size_t n);
+	void (*fill_)(int *a, size_t n, int value);
+	size_t (*index_of_)(const int *a, size_t n, int value); // n when absent
+	void (*add_)(const int *a, const int *b, int *out, size_t n);
+	void (*mul_)(const int *a, const int *b, int *out, size_t n);
+};
+
+const Kernels &kernels();
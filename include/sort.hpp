@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+// Introsort for user comparators. Unlike std::sort every scan is bounds checked,
+// so a comparator that is not a strict weak order gives a wrong order, never a
+// read past the range. Comparisons may run script code, which must not touch
+// the range itself.
+namespace introsort_detail
+{
+	constexpr long INSERTION_LIMIT = 16;
+
+	template <typename It, typename Less>
+	void insertion_sort(It first, It last, Less &less)
+	{
+		if (first == last)
+			return;
+		for (auto i = first + 1; i < last; ++i)
+			for (auto j = i; j > first && less(*j, *(j - 1)); --j)
+				std::iter_swap(j, j - 1);
+	}
+
+	// median of three becomes the pivot at first, returns where it ends up
+	template <typename It, typename Less>
+	It partition_around_pivot(It first, It last, Less &less)
+	{
+		auto mid = first + (last - first) / 2;
+		auto back = last - 1;
+		if (less(*mid, *first))
+			std::iter_swap(mid, first);
+		if (less(*back, *mid))
+		{
+			std::iter_swap(back, mid);
+			if (less(*mid, *first))
+				std::iter_swap(mid, first);
+		}
+		std::iter_swap(first, mid);
+
+		auto i = first + 1, j = back;
+		while (true)
+		{
+			while (i <= j && less(*i, *first))
+				++i;
+			while (i <= j && less(*first, *j))
+				--j;
+			if (i >= j)
+				break;
+			std::iter_swap(i, j);
+			++i;
+			--j;
+		}
+		std::iter_swap(first, j);
+		return j;
+	}
+
+	template <typename It, typename Less>
+	void sort(It first, It last, Less &less, int depth)
+	{
+		while (last - first > INSERTION_LIMIT)
+		{
+			if (depth-- == 0)
+			{
+				std::make_heap(first, last, std::ref(less));
+				std::sort_heap(first, last, std::ref(less));
+				return;
+			}
+			auto pivot = partition_around_pivot(first, last, less);
+			// recurse into the smaller side so the stack stays logarithmic
+			if (pivot - first < last - pivot)
+			{
+				introsort_detail::sort(first, pivot, less, depth);
+				first = pivot + 1;
+			}
+			else
+			{
+				introsort_detail::sort(pivot + 1, last, less, depth);
+				last = pivot;
+			}
+		}
+		introsort_detail::insertion_sort(first, last, less);
+	}
+}
+
+template <typename It, typename Less>
+void introsort(It first, It last, Less less)
+{
+	int depth = 0;
+	for (auto n = last - first; n > 1; n >>= 1)
+		depth += 2;
+	introsort_detail::sort(first, last, less, depth);
+}
@@ -1,10 +1,57 @@
 #pragma once
+#include <cstdint>
 #include <map>
+#include <string_view>
+#include <vector>
 #include "value.hpp"
 
 struct ObjString;
+struct ObjClosure;
+struct ObjBoundMethod;
 
 template<typename T>
 struct Allocator;
 
-using Table = std::map<ObjString*, Value, std::less<ObjString*>, Allocator<std::pair<ObjString* const, Value>>>;
\ No newline at end of file
+using Table = std::map<ObjString*, Value, std::less<ObjString*>, Allocator<std::pair<ObjString* const, Value>>>;
+// an instance's escaped bound methods, keyed by closure so there is at most one per method
+using BoundMethods = std::map<ObjClosure*, ObjBoundMethod*, std::less<ObjClosure*>, Allocator<std::pair<ObjClosure* const, ObjBoundMethod*>>>;
+
+// the intern set, open addressing probed by the hash cached in each string.
+// slots live in malloc memory so growing it never starts a collection
+class StringTable
+{
+public:
+	ObjString *find(std::string_view text, uint32_t hash) const;
+	void insert(ObjString *str);
+	size_t size() const noexcept { return count_; }
+
+	// dead strings leave a tombstone so later probes keep going
+	template <typename Pred>
+	void remove_if(Pred pred)
+	{
+		for (auto &slot : slots_)
+			if (slot != nullptr && slot != tombstone() && pred(slot))
+			{
+				slot = tombstone();
+				count_--;
+				tombstones_++;
+			}
+	}
+
+	// a moved string keeps its hash and so its slot
+	template <typename F>
+	void for_each(F f)
+	{
+		for (auto &slot : slots_)
+			if (slot != nullptr && slot != tombstone())
+				f(slot);
+	}
+
+private:
+	static ObjString *tombstone() noexcept;
+	void grow();
+
+	std::vector<ObjString *> slots_;
+	size_t count_ = 0;
+	size_t tombstones_ = 0;
+};
@@ -26,6 +26,7 @@ enum TokenType
     TOKEN_GREATER_EQUAL,
     TOKEN_LESS,
     TOKEN_LESS_EQUAL,
+    TOKEN_DOT_DOT,
     // Literals.
     TOKEN_IDENTIFIER,
     TOKEN_STRING,
@@ -50,6 +51,10 @@ enum TokenType
     TOKEN_WHILE,
     TOKEN_CONTINUE,
     TOKEN_BREAK,
+    TOKEN_IN,
+    TOKEN_SWITCH,
+    TOKEN_CASE,
+    TOKEN_DEFAULT,
 
     TOKEN_ERROR,
     TOKEN_EOF,
@@ -24,6 +24,7 @@ public:
         switch (instruction)
         {
         case Opcode::OP_CALL:
+        case Opcode::OP_TAIL_CALL:
         case Opcode::OP_SET_LOCAL:
         case Opcode::OP_GET_LOCAL:
         case Opcode::OP_SET_UPVALUE:
@@ -59,10 +60,20 @@ public:
         case Opcode::OP_RESUME_COROUTINE:
         case Opcode::OP_CREATE_COROUTINE:
         case Opcode::OP_YIELD_COROUTINE:
+        case Opcode::OP_ITER_INIT:
+        case Opcode::OP_RANGE_INIT:
         {
             std::cout << "  " << instruction << std::endl;
             return offset + 1;
         }
+        case Opcode::OP_TABLE_SWITCH:
+        case Opcode::OP_HASH_SWITCH:
+        {
+            auto &table = chunk.switches_[chunk.bytecode_[offset + 1]];
+            std::cout << "  " << instruction << " [" << static_cast<int>(chunk.bytecode_[offset + 1]) << "] cases: "
+                      << table.dense_.size() + table.cases_.size() << " default -> " << table.default_ << std::endl;
+            return offset + 2;
+        }
         case Opcode::OP_ARRAY:
         {
             int count = chunk.bytecode_[offset + 1]; // can't use uint8 because unsigned char is null
@@ -94,6 +105,50 @@ public:
         {
             return jumpInstruction(-1, chunk, offset);
         }
+        case Opcode::OP_ITER_NEXT:
+        {
+            auto slot = chunk.bytecode_[offset + 1];
+            uint16_t jump = (uint16_t)(chunk.bytecode_[offset + 2] << 8);
+            jump |= chunk.bytecode_[offset + 3];
+            std::cout << "  " << instruction << " [" << static_cast<int>(slot) << "] -> " << offset + 4 + jump << std::endl;
+            return offset + 4;
+        }
+        case Opcode::OP_INLINE_RETURN:
+        {
+            auto count = chunk.bytecode_[offset + 1];
+            std::cout << "  " << instruction << " [" << static_cast<int>(count) << "] " << std::endl;
+            return offset + 2;
+        }
+        case Opcode::OP_GUARD_CALL:
+        {
+            auto argCount = chunk.bytecode_[offset + 1];
+            auto constant = chunk.bytecode_[offset + 2];
+            uint16_t jump = (uint16_t)(chunk.bytecode_[offset + 3] << 8);
+            jump |= chunk.bytecode_[offset + 4];
+            std::cout << "  " << instruction << "(args: " << int(argCount) << ") " << chunk.constants_[constant]
+                      << " else -> " << offset + 5 + jump << std::endl;
+            return offset + 5;
+        }
+        case Opcode::OP_GUARD_INVOKE:
+        {
+            auto name = chunk.bytecode_[offset + 1];
+            auto argCount = chunk.bytecode_[offset + 2];
+            auto constant = chunk.bytecode_[offset + 3];
+            uint16_t jump = (uint16_t)(chunk.bytecode_[offset + 4] << 8);
+            jump |= chunk.bytecode_[offset + 5];
+            std::cout << "  " << instruction << "(args: " << int(argCount) << ") [" << int(name) << "] " << chunk.constants_[name]
+                      << " " << chunk.constants_[constant] << " else -> " << offset + 6 + jump << std::endl;
+            return offset + 6;
+        }
+        case Opcode::OP_FOR_RANGE:
+        case Opcode::OP_FOR_COUNT:
+        {
+            auto slot = chunk.bytecode_[offset + 1];
+            uint16_t jump = (uint16_t)(chunk.bytecode_[offset + 2] << 8);
+            jump |= chunk.bytecode_[offset + 3];
+            std::cout << "  " << instruction << " [" << static_cast<int>(slot) << "] -> " << offset + 4 - jump << std::endl;
+            return offset + 4;
+        }
         case Opcode::OP_CLOSURE:
         {
             offset++;
@@ -103,6 +158,7 @@ public:
         }
         case Opcode::OP_SUPER_INVOKE:
         case Opcode::OP_INVOKE:
+        case Opcode::OP_TAIL_INVOKE:
         {
             auto constant = chunk.bytecode_[offset + 1];
             auto argCount = chunk.bytecode_[offset + 2];
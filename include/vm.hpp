@@ -9,15 +9,25 @@
 #include "object.hpp"
 #include "scheduler.hpp"
 #include "common.hpp"
+#include "binding.hpp"
+#include <optional>
 
 
 struct GC;
 
+bool is_falsey(const Value &value);
+
 class VM
 {
 public:
-    VM(); 
-    InterpretResult run(ObjCoroutine* co);
+    explicit VM(const GCConfig &config = GCConfig::from_env());
+    ~VM();
+    // a nested run for a native stops once the frame count is back to stop_depth
+    InterpretResult run(ObjCoroutine* co, int stop_depth = 0);
+    InterpretResult dispatch(ObjCoroutine* co, int stop_depth);
+    Value call_closure(const Value& callee, const Value* args, int argCount);
+    Value call_closure(const Value& callee, std::initializer_list<Value> args);
+    ObjArray* sort_array(ObjArray* array, std::optional<Value> cmp);
 
     template <typename Operator>
     bool binary_op(Operator op);
@@ -26,6 +36,7 @@ public:
     void reset_stack();
     Value pop();
     Value peek(int distance);
+    void intern_key(int distance);
     void close_upvalues(Value* last);
     void define_method(ObjString* name);
     bool bind_method(ObjClass* klass, ObjString* name);
@@ -35,6 +46,7 @@ public:
     bool invoke(ObjString* name, int argCount);
     bool invoke_from_class(ObjClass* klass, ObjString* name,
                             int argCount); 
+    void reuse_frame();
 
 
     ObjUpvalue* capture_upvalue(Value* local);
@@ -43,6 +55,10 @@ public:
 	void runtime_error(Args&&... args);
 
     void define_native(std::string_view name, NativeFn function);
+    // binds a typed function, see binding.hpp
+    template <auto Fn>
+    void define_native(std::string_view name) { define_native(name, &binding::Thunk<Fn>::call); }
+    ObjArray* elementwise(ObjArray* a, ObjArray* b, void (*kernel)(const int *, const int *, int *, size_t));
 
     InterpretResult interpret(const std::string& source);
 
@@ -57,5 +73,7 @@ public:
     // std::vector<Value> stack_;
     GC gc_;
     Scheduler scheduler_;
+    std::string concat_buffer_; // scratch for OP_ADD on strings
+    int reentry_depth_ = 0;     // natives running script code, see call_closure
     
 };
\ No newline at end of file
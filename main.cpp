@@ -7,8 +7,8 @@
 #include <iostream>
 #include <fstream>
 
-static void REPL() {
-    VM vm;
+static void REPL(const GCConfig& config) {
+    VM vm(config);
     std::string line;
     std::string codeBuffer;
 
@@ -53,9 +53,9 @@ static std::string readFile(const std::string& path) {
     return buffer; // Return the file content as a string
 }
 
-static void runFile(const std::string& path) {
+static void runFile(const std::string& path, const GCConfig& config) {
     try {
-        VM vm;
+        VM vm(config);
         std::string source = readFile(path);  // Automatically managed string
         InterpretResult result = vm.interpret(source);
 
@@ -69,10 +69,18 @@ static void runFile(const std::string& path) {
 
 int main(int argc, char** argv)
 {
-    if(argc == 1) {
-        REPL();
-    } else if(argc == 2) {
-        runFile(argv[1]);
+    auto config = GCConfig::from_env();
+    int arg = 1;
+    for (; arg < argc && std::string_view(argv[arg]).substr(0, 2) == "--"; arg++) {
+        if (!config.parse_flag(argv[arg])) {
+            std::cerr << "Unknown option " << argv[arg] << std::endl;
+            exit(1);
+        }
+    }
+    if(arg == argc) {
+        REPL(config);
+    } else if(arg + 1 == argc) {
+        runFile(argv[arg], config);
     } else {
         exit(1);
     }
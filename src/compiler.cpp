@@ -50,6 +50,11 @@ Complication::Complication(VM &vm) : current_(nullptr), parser_(nullptr), vm_(vm
                                                                                        {TOKEN_TRUE, {&Complication::literal, nullptr, PREC_NONE}},
                                                                                        {TOKEN_VAR, {nullptr, nullptr, PREC_NONE}},
                                                                                        {TOKEN_WHILE, {nullptr, nullptr, PREC_NONE}},
+                                                                                       {TOKEN_IN, {nullptr, nullptr, PREC_NONE}},
+                                                                                       {TOKEN_DOT_DOT, {nullptr, nullptr, PREC_NONE}},
+                                                                                       {TOKEN_SWITCH, {nullptr, nullptr, PREC_NONE}},
+                                                                                       {TOKEN_CASE, {nullptr, nullptr, PREC_NONE}},
+                                                                                       {TOKEN_DEFAULT, {nullptr, nullptr, PREC_NONE}},
                                                                                        {TOKEN_ERROR, {nullptr, nullptr, PREC_NONE}},
                                                                                        {TOKEN_EOF, {nullptr, nullptr, PREC_NONE}},
                                                                                        {TOKEN_COLON, {nullptr, nullptr, PREC_NONE}},
@@ -63,6 +68,9 @@ Complication::Complication(VM &vm) : current_(nullptr), parser_(nullptr), vm_(vm
 ObjFunction *Complication::compile(const std::string_view &source)
 {
     parser_ = std::make_unique<Parser>(source);
+    // compaction may move the functions of an earlier compile
+    inline_functions_.clear();
+    inline_methods_.clear();
     init_compiler(TYPE_SCRIPT);
     advance();
     while (!match(TOKEN_EOF))
@@ -72,6 +80,13 @@ ObjFunction *Complication::compile(const std::string_view &source)
     return parser_->has_error_ ? nullptr : function;
 }
 
+void Complication::reset()
+{
+    current_ = nullptr;
+    current_class_ = nullptr;
+    current_loop_ = nullptr;
+}
+
 Chunk *Complication::current_chunk()
 {
     return &current_->function_->chunk_;
@@ -372,17 +387,179 @@ void Complication::super_(bool assign)
     }
     else
     {
+        current_->super_load_ = current_chunk()->bytecode_.size();
         name_variable(syntehtic_token("super"), false);
+        current_->super_get_ = current_chunk()->bytecode_.size();
         emit_bytes(OP_GET_SUPER, name);
     }
 }
 
+// (a.b)() and (super.b)() would bind a method only to call and drop it, so a load
+// that ends the callee becomes OP_INVOKE or OP_SUPER_INVOKE. A jump landing after
+// the load means the callee is not always that load and the code is left alone.
 void Complication::call(bool canAssign)
 {
+    auto &bytecode = current_chunk()->bytecode_;
+    int end = bytecode.size();
+    if (current_->property_get_ == end - 2 && current_->jump_target_ <= current_->property_get_)
+    {
+        uint8_t name = bytecode[end - 1];
+        truncate_chunk(current_->property_get_);
+        uint8_t argCount = argument_list();
+        auto method = inline_methods_.find(current_chunk()->constants_[name].as_obj<ObjString>()->text());
+        InlineBody body;
+        if (method != inline_methods_.end() && method->second != nullptr && inline_body(method->second, true, body))
+        {
+            emit_bytes(OP_GUARD_INVOKE, name);
+            emit_inline(method->second, argCount, body);
+            return;
+        }
+        current_->call_ = current_chunk()->bytecode_.size();
+        emit_bytes(OP_INVOKE, name);
+        emit_byte(argCount);
+        return;
+    }
+    if (current_->super_get_ == end - 2 && current_->jump_target_ <= current_->super_load_)
+    {
+        // the superclass is loaded after the arguments for OP_SUPER_INVOKE
+        uint8_t name = bytecode[end - 1];
+        std::vector<uint8_t> load(bytecode.begin() + current_->super_load_, bytecode.begin() + current_->super_get_);
+        truncate_chunk(current_->super_load_);
+        uint8_t argCount = argument_list();
+        for (auto byte : load)
+            emit_byte(byte);
+        emit_bytes(OP_SUPER_INVOKE, name);
+        emit_byte(argCount);
+        return;
+    }
+    if (current_->global_get_ == end - 2 && current_->jump_target_ <= current_->global_get_)
+    {
+        uint8_t name = bytecode[end - 1];
+        auto callee = inline_functions_.find(current_chunk()->constants_[name].as_obj<ObjString>()->text());
+        InlineBody body;
+        if (callee != inline_functions_.end() && inline_body(callee->second, false, body))
+        {
+            // the callee is loaded before the arguments, as for OP_CALL
+            uint8_t argCount = argument_list();
+            emit_byte(OP_GUARD_CALL);
+            emit_inline(callee->second, argCount, body);
+            return;
+        }
+    }
     uint8_t argCount = argument_list();
+    current_->call_ = current_chunk()->bytecode_.size();
     emit_bytes(OP_CALL, argCount);
 }
 
+// A callee whose body up to its first return is straight-line code reading only its
+// parameters, constants, globals and properties is copied into the caller. Parameter
+// loads become OP_PEEK at the depth they run at, unless the body starts by loading
+// every argument in order: then it runs on the arguments where they are. OP_GUARD_CALL
+// drops the callee under the arguments, so only a method body may read slot 0.
+bool Complication::inline_body(ObjFunction *callee, bool method, InlineBody &body)
+{
+    constexpr size_t MAX_INLINE_BYTES = 32;
+    if (callee->upvalue_count_ != 0)
+        return false;
+    auto &code = callee->chunk_.bytecode_;
+    int first = method ? 0 : 1;
+    int count = callee->arity_ + 1 - first;
+
+    auto translate = [&](bool inPlace)
+    {
+        body = InlineBody();
+        size_t ip = 0;
+        if (inPlace)
+            for (int slot = first; slot < first + count; slot++, ip += 2)
+                if (ip + 1 >= code.size() || code[ip] != OP_GET_LOCAL || code[ip + 1] != slot)
+                    return false;
+        body.slide_ = inPlace ? 0 : count;
+        int depth = 0;
+        for (;; ip++)
+        {
+            if (ip >= code.size() || body.code_.size() > MAX_INLINE_BYTES)
+                return false;
+            auto op = static_cast<Opcode>(code[ip]);
+            if (op == OP_RETURN)
+                return true;
+            switch (op)
+            {
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                depth++;
+                [[fallthrough]];
+            case OP_NEGATE:
+            case OP_NOT:
+                body.code_.push_back(op);
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_GET_ELEMENT:
+            case OP_POP:
+                depth--;
+                body.code_.push_back(op);
+                break;
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+                depth++;
+                [[fallthrough]];
+            case OP_GET_PROPERTY:
+                body.code_.push_back(op);
+                body.constants_.push_back({body.code_.size(), callee->chunk_.constants_[code[++ip]]});
+                body.code_.push_back(0);
+                break;
+            case OP_GET_LOCAL:
+            {
+                int slot = code[++ip];
+                int distance = first + count - 1 - slot + depth;
+                if (inPlace || slot < first || distance > UINT8_MAX)
+                    return false;
+                body.code_.push_back(OP_PEEK);
+                body.code_.push_back(distance);
+                depth++;
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+    };
+    return translate(true) || translate(false);
+}
+
+// Follows the guard the caller emitted. The guard checks that the callee, or the
+// receiver's method, is still the function that was copied and otherwise calls it
+// and skips the copy.
+void Complication::emit_inline(ObjFunction *callee, uint8_t argCount, InlineBody &body)
+{
+    // a call with the wrong argument count or no room for the constants always goes
+    // through the guard's call, which reports or makes it
+    bool fits = argCount == callee->arity_ &&
+                current_chunk()->constants_.size() + body.constants_.size() + 1 <= UINT8_MAX + 1;
+    uint8_t function = fits ? make_constant(callee) : make_constant(Value());
+    emit_bytes(argCount, function);
+    int skip = current_chunk()->bytecode_.size();
+    emit_bytes(0xff, 0xff);
+    if (fits)
+    {
+        int begin = current_chunk()->bytecode_.size();
+        for (auto &[offset, constant] : body.constants_)
+            body.code_[offset] = make_constant(constant);
+        for (auto byte : body.code_)
+            emit_byte(byte);
+        current_chunk()->inlined_.push_back({begin, static_cast<int>(current_chunk()->bytecode_.size()), function});
+        if (body.slide_ > 0)
+            emit_bytes(OP_INLINE_RETURN, body.slide_);
+    }
+    patch_jump(skip);
+}
+
 void Complication::literal(bool canAssign)
 {
     switch (parser_->previous_.type)
@@ -430,6 +607,8 @@ void Complication::statement()
         while_statement();
     else if (match(TOKEN_FOR))
         for_statement();
+    else if (match(TOKEN_SWITCH))
+        switch_statement();
     else if (match(TOKEN_LEFT_BRACE))
     {
         begin_scope();
@@ -494,11 +673,13 @@ void Complication::dot(bool canAssign)
     else if (match(TOKEN_LEFT_PAREN))
     {
         uint8_t argCount = argument_list();
+        current_->call_ = current_chunk()->bytecode_.size();
         emit_bytes(OP_INVOKE, arg);
         emit_byte(argCount);
     }
     else
     {
+        current_->property_get_ = current_chunk()->bytecode_.size();
         emit_bytes(OP_GET_PROPERTY, arg);
     }
 }
@@ -540,7 +721,17 @@ void Complication::for_statement()
     }
     else if (match(TOKEN_VAR))
     {
-        var_declaration();
+        consume(TOKEN_IDENTIFIER, "Expect variable declare.");
+        Token name = parser_->previous_;
+        if (match(TOKEN_IN))
+        {
+            for_in_statement(name);
+            current_loop_ = std::move(current_loop_->outer_);
+            end_scope();
+            return;
+        }
+        declare_variable();
+        var_initializer(0); // the loop scope makes it a local
     }
     else
     {
@@ -574,7 +765,9 @@ void Complication::for_statement()
 
     statement();
     emit_loop(loopStart);
-    patch_offset(loopStart, current_chunk()->bytecode_.size());
+    // OP_BREAK skips the condition pop at the loop end, which is missing without a condition
+    int loopEnd = current_chunk()->bytecode_.size();
+    patch_offset(loopStart, exitJump == -1 ? loopEnd - 1 : loopEnd);
 
     if (exitJump != -1)
     {
@@ -586,6 +779,75 @@ void Complication::for_statement()
     end_scope();
 }
 
+// for (var x in coll) keeps coll and a cursor in two hidden locals below x.
+// OP_ITER_NEXT stores the next element, or key for Json, into x or leaves the loop.
+void Complication::for_in_statement(const Token &name)
+{
+    expression();
+    if (match(TOKEN_DOT_DOT))
+    {
+        for_range_statement(name);
+        return;
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    uint8_t slot = current_->local_count_;
+    emit_byte(OP_ITER_INIT);
+    add_local(syntehtic_token("for collection"));
+    mark_initialize();
+    add_local(syntehtic_token("for cursor"));
+    mark_initialize();
+    emit_byte(OP_NIL);
+    add_local(name);
+    mark_initialize();
+
+    int loopStart = current_chunk()->bytecode_.size();
+    emit_bytes(OP_ITER_NEXT, slot);
+    int exitJump = current_chunk()->bytecode_.size();
+    emit_bytes(0xff, 0xff);
+
+    statement();
+    emit_loop(loopStart);
+    // a break lands one past the offset it is given, there is no condition to skip
+    patch_offset(loopStart, current_chunk()->bytecode_.size() - 1);
+    patch_jump(exitJump);
+}
+
+// for (var i in a..b) counts from a up to but excluding b, both evaluated once. The
+// counter and bound are hidden locals below i that OP_RANGE_INIT checks are ints, and
+// OP_FOR_RANGE at the bottom of the loop increments, compares and jumps back to the
+// body in one instruction. OP_FOR_COUNT does the same without storing i.
+void Complication::for_range_statement(const Token &name)
+{
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    emit_byte(OP_RANGE_INIT);
+
+    uint8_t slot = current_->local_count_;
+    add_local(syntehtic_token("for counter"));
+    mark_initialize();
+    add_local(syntehtic_token("for bound"));
+    mark_initialize();
+    emit_byte(OP_NIL);
+    add_local(name);
+    mark_initialize();
+
+    int bodyJump = emit_jump(OP_JUMP);
+    int bodyStart = current_chunk()->bytecode_.size();
+    statement();
+    int loopStart = current_chunk()->bytecode_.size();
+    patch_jump(bodyJump);
+
+    // the body is compiled, so whether it refers to i, directly or from a closure, is known
+    emit_bytes(current_->locals_[slot + 2].is_referenced_ ? OP_FOR_RANGE : OP_FOR_COUNT, slot);
+    int offset = current_chunk()->bytecode_.size() - bodyStart + 2;
+    if (offset > UINT16_MAX)
+        parser_->error("Loop body too large.");
+    emit_bytes((offset >> 8) & 0xff, offset & 0xff);
+    // a break lands one past the offset it is given, there is no condition to skip
+    patch_offset(loopStart, current_chunk()->bytecode_.size() - 1);
+}
+
 void Complication::patch_offset(int loopStart, int loopEnd)
 {
     for (const auto &[offset, _] : current_loop_->offsets_)
@@ -629,6 +891,14 @@ void Complication::return_statement()
 
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+        // a call the value ends with runs in this function's frame. OP_RETURN stays
+        // for callees that push no frame and for jumps landing after the call
+        auto &bytecode = current_chunk()->bytecode_;
+        int end = bytecode.size(), call = current_->call_;
+        if (call >= 0 && call == end - 2 && bytecode[call] == OP_CALL)
+            bytecode[call] = OP_TAIL_CALL;
+        else if (call >= 0 && call == end - 3 && bytecode[call] == OP_INVOKE)
+            bytecode[call] = OP_TAIL_INVOKE;
         emit_byte(OP_RETURN);
     }
 }
@@ -673,16 +943,104 @@ void Complication::if_statement()
     int else_jump = emit_jump(OP_JUMP);
     // Optional else
     patch_jump(then_jump);
+    emit_byte(OP_POP); // Pop the last condition
     if (match(TOKEN_ELSE))
-    {
-        emit_byte(OP_POP); // Pop the last condition
         statement();
-        patch_jump(else_jump);
-    }
+    patch_jump(else_jump);
     for (auto &patch : patchs)
         patch_jump(patch);
 }
 
+// Cases do not fall through, each runs its statements in its own scope and leaves the
+// switch. The labels go into the chunk's table as they are parsed, which keeps the
+// strings reachable, and the dispatch becomes OP_TABLE_SWITCH at the end when they
+// turn out to be ints filling at least half of their range.
+void Complication::switch_statement()
+{
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after switch value.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
+
+    auto index = current_chunk()->switches_.size();
+    if (index > UINT8_MAX)
+        parser_->error("Too many switch statements in one function.");
+    current_chunk()->switches_.emplace_back();
+    int dispatch = current_chunk()->bytecode_.size();
+    emit_bytes(OP_HASH_SWITCH, index);
+
+    int defaultTarget = -1;
+    std::vector<int> exits;
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    {
+        int target = current_chunk()->bytecode_.size();
+        if (match(TOKEN_CASE))
+        {
+            do
+            {
+                auto label = case_label();
+                if (!current_chunk()->switches_[index].cases_.emplace(label, target).second)
+                    parser_->error("Duplicate case label.");
+            } while (match(TOKEN_COMMA));
+        }
+        else
+        {
+            consume(TOKEN_DEFAULT, "Expect 'case' or 'default' in switch.");
+            if (defaultTarget != -1)
+                parser_->error("Switch has more than one default.");
+            defaultTarget = target;
+        }
+        consume(TOKEN_COLON, "Expect ':' after case label.");
+
+        begin_scope();
+        while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+            declaration();
+        end_scope();
+        exits.push_back(emit_jump(OP_JUMP));
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch cases.");
+    for (auto exit : exits)
+        patch_jump(exit);
+
+    auto &table = current_chunk()->switches_[index];
+    table.default_ = defaultTarget == -1 ? current_chunk()->bytecode_.size() : defaultTarget;
+    if (table.cases_.empty())
+        return;
+    int64_t low = INT32_MAX, high = INT32_MIN;
+    for (const auto &[label, _] : table.cases_)
+    {
+        if (!label.is_number())
+            return;
+        low = std::min<int64_t>(low, label.as<int>());
+        high = std::max<int64_t>(high, label.as<int>());
+    }
+    if (high - low + 1 > 2 * static_cast<int64_t>(table.cases_.size()))
+        return;
+    table.low_ = low;
+    table.dense_.assign(high - low + 1, table.default_);
+    for (const auto &[label, target] : table.cases_)
+        table.dense_[label.as<int>() - low] = target;
+    table.cases_.clear();
+    current_chunk()->bytecode_[dispatch] = OP_TABLE_SWITCH;
+}
+
+Value Complication::case_label()
+{
+    bool negate = match(TOKEN_MINUS);
+    if (match(TOKEN_NUMBER))
+    {
+        int value = std::stoi(std::string(parser_->previous_.string));
+        return negate ? -value : value;
+    }
+    if (!negate && match(TOKEN_STRING))
+    {
+        std::string_view text = parser_->previous_.string;
+        return create_obj_string(text.substr(1, text.size() - 2), vm_);
+    }
+    parser_->error_at_current("Expect a number or string as case label.");
+    return Value();
+}
+
 void Complication::expression_statement()
 {
     expression();
@@ -692,7 +1050,11 @@ void Complication::expression_statement()
 
 void Complication::var_declaration()
 {
-    uint8_t global = parse_variable("Expect variable declare.");
+    var_initializer(parse_variable("Expect variable declare."));
+}
+
+void Complication::var_initializer(uint8_t global)
+{
     if (match(TOKEN_EQUAL))
         expression();
     else
@@ -743,6 +1105,8 @@ void Complication::name_variable(const Token &name, bool canAssign)
     }
     else
     {
+        if (getOp == OP_GET_GLOBAL)
+            current_->global_get_ = current_chunk()->bytecode_.size();
         emit_bytes(getOp, arg);
     }
 }
@@ -759,6 +1123,7 @@ int Complication::resolve_local(const std::unique_ptr<Compiler> &compiler, const
                                                                            //     var a = a;  // we first define a and search a but this is not initialized
                                                                            //                 // if we first expression not define can get a = 1 result
                                                                            // }
+            local.is_referenced_ = true;
             return i;
         }
     }
@@ -867,6 +1232,17 @@ void Complication::patch_jump(int offset)
 
     current_chunk()->bytecode_[offset] = (jump >> 8) & 0xff;
     current_chunk()->bytecode_[offset + 1] = jump & 0xff;
+    current_->jump_target_ = current_chunk()->bytecode_.size();
+}
+
+void Complication::truncate_chunk(int size)
+{
+    current_chunk()->bytecode_.resize(size);
+    current_chunk()->lines_.resize(size);
+    auto &inlined = current_chunk()->inlined_;
+    while (!inlined.empty() && inlined.back().begin_ >= size)
+        inlined.pop_back();
+    current_->property_get_ = current_->super_load_ = current_->super_get_ = current_->global_get_ = current_->call_ = -1;
 }
 
 bool Complication::check(TokenType type)
@@ -968,7 +1344,10 @@ void Complication::fun_declaration()
 {
     uint8_t global = parse_variable("Expect function name."); // before closure all function is global
     mark_initialize();                                        // why initialize
-    function(TYPE_FUNCTION);
+    auto name = parser_->previous_.string;
+    auto function = this->function(TYPE_FUNCTION);
+    if (current_->scope_depth_ == 0)
+        inline_functions_[name] = function;
     define_variable(global);
 }
 
@@ -977,7 +1356,7 @@ void Complication::function_expr(bool assign)
     function(FunctionType::TYPE_FUNCTION);
 }
 
-void Complication::function(FunctionType type)
+ObjFunction *Complication::function(FunctionType type)
 {
     init_compiler(type);
     begin_scope();
@@ -1006,16 +1385,24 @@ void Complication::function(FunctionType type)
         emit_byte(done->upvalues_[i].is_local_ ? 1 : 0);
         emit_byte(done->upvalues_[i].index_);
     }
+    return function;
 }
 
 void Complication::method()
 {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
     uint8_t constant = identifier_constant(parser_->previous_);
+    auto name = parser_->previous_.string;
     FunctionType type = TYPE_METHOD;
-    if (parser_->previous_.string == "init")
+    if (name == "init")
         type = TYPE_INITIALIZER;
-    function(type);
+    auto function = this->function(type);
+    if (type == TYPE_METHOD)
+    {
+        auto [known, added] = inline_methods_.emplace(name, function);
+        if (!added && known->second != function)
+            known->second = nullptr;
+    }
     emit_bytes(OP_METHOD, constant);
 }
 
@@ -1039,6 +1426,7 @@ void Complication::add_local(Token name)
     Local &local = current_->locals_[current_->local_count_++];
     local.name_ = name;
     local.depth_ = -1;
+    local.is_referenced_ = false;
 }
 
 bool Complication::identifier_equal(const Token &a, const Token &b)
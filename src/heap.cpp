@@ -0,0 +1,249 @@
+#include "heap.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <new>
+
+constexpr size_t HEADER_SIZE = (sizeof(Arena) + GRANULE - 1) & ~(GRANULE - 1);
+constexpr size_t SMALL_LIMIT = 256;
+constexpr size_t CLASS_COUNT = SMALL_LIMIT / GRANULE + (MAX_SLOT_SIZE - SMALL_LIMIT) / SMALL_LIMIT;
+
+char *Arena::begin() noexcept
+{
+	return reinterpret_cast<char *>(this) + HEADER_SIZE;
+}
+
+size_t Arena::live_count() const noexcept
+{
+	size_t count = 0;
+	for (auto word : live_)
+		count += __builtin_popcountll(word);
+	return count;
+}
+
+Heap::Heap() : classes_(CLASS_COUNT)
+{
+}
+
+Heap::~Heap()
+{
+	while (arenas_ != nullptr)
+		release(arenas_);
+}
+
+// 16 byte steps up to 256, 256 byte steps up to MAX_SLOT_SIZE
+size_t Heap::class_of(size_t size) noexcept
+{
+	if (size <= SMALL_LIMIT)
+		return (std::max<size_t>(size, 1) - 1) / GRANULE;
+	return SMALL_LIMIT / GRANULE + (size - SMALL_LIMIT - 1) / SMALL_LIMIT;
+}
+
+size_t Heap::slot_size_of(size_t cls) noexcept
+{
+	if (cls < SMALL_LIMIT / GRANULE)
+		return (cls + 1) * GRANULE;
+	return (cls - SMALL_LIMIT / GRANULE + 2) * SMALL_LIMIT;
+}
+
+Arena *Heap::new_arena(size_t slot_size, size_t bytes)
+{
+	void *mem = nullptr;
+	if (posix_memalign(&mem, ARENA_SIZE, bytes) != 0)
+		throw std::bad_alloc();
+	auto arena = new (mem) Arena();
+	std::memset(arena->marks_, 0, sizeof(arena->marks_));
+	std::memset(arena->live_, 0, sizeof(arena->live_));
+	arena->slot_size_ = slot_size;
+	arena->slot_count_ = slot_size == 0 ? 1 : (ARENA_SIZE - HEADER_SIZE) / slot_size;
+	arena->bump_ = arena->begin();
+	arena->next_ = arenas_;
+	if (arenas_ != nullptr)
+		arenas_->prev_ = arena;
+	arenas_ = arena;
+	arena_count_++;
+	return arena;
+}
+
+void Heap::release(Arena *arena)
+{
+	if (arena->prev_ != nullptr)
+		arena->prev_->next_ = arena->next_;
+	else
+		arenas_ = arena->next_;
+	if (arena->next_ != nullptr)
+		arena->next_->prev_ = arena->prev_;
+	arena->~Arena();
+	std::free(arena);
+	arena_count_--;
+}
+
+void *Heap::allocate(size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (size > MAX_SLOT_SIZE)
+	{
+		auto arena = new_arena(0, HEADER_SIZE + size);
+		arena->large_size_ = size;
+		arena->used_ = 1;
+		return arena->begin();
+	}
+	auto cls = class_of(size);
+	auto &sizeClass = classes_[cls];
+	auto arena = sizeClass.current_;
+	if (arena == nullptr || arena->used_ == arena->slot_count_)
+	{
+		if (!sizeClass.partial_.empty())
+		{
+			arena = sizeClass.partial_.back();
+			sizeClass.partial_.pop_back();
+		}
+		else
+			arena = new_arena(slot_size_of(cls), ARENA_SIZE);
+		sizeClass.current_ = arena;
+	}
+	void *p;
+	if (arena->free_ != nullptr)
+	{
+		p = arena->free_;
+		arena->free_ = *static_cast<void **>(p);
+	}
+	else
+	{
+		p = arena->bump_;
+		arena->bump_ += arena->slot_size_;
+	}
+	arena->used_++;
+	return p;
+}
+
+void Heap::deallocate(void *p, size_t)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto arena = Arena::of(p);
+	if (arena->is_large())
+	{
+		release(arena);
+		return;
+	}
+	bool was_full = arena->used_ == arena->slot_count_;
+	*static_cast<void **>(p) = arena->free_;
+	arena->free_ = p;
+	arena->used_--;
+
+	auto &sizeClass = classes_[class_of(arena->slot_size_)];
+	if (arena == sizeClass.current_)
+		return;
+	if (arena->evacuating_)
+	{
+		if (arena->used_ == 0)
+			release(arena);
+	}
+	else if (arena->used_ == 0)
+	{
+		// give empty arenas back so resident memory follows the live heap
+		auto it = std::find(sizeClass.partial_.begin(), sizeClass.partial_.end(), arena);
+		if (it != sizeClass.partial_.end())
+			sizeClass.partial_.erase(it);
+		release(arena);
+	}
+	else if (was_full)
+		sizeClass.partial_.push_back(arena);
+}
+
+bool Heap::mark(const void *p) noexcept
+{
+	auto index = Arena::index_of(p);
+	uint64_t bit = uint64_t(1) << (index % 64);
+	auto old = __atomic_fetch_or(&Arena::of(p)->marks_[index / 64], bit, __ATOMIC_RELAXED);
+	return (old & bit) == 0;
+}
+
+bool Heap::is_marked(const void *p) noexcept
+{
+	auto index = Arena::index_of(p);
+	uint64_t bit = uint64_t(1) << (index % 64);
+	return (__atomic_load_n(&Arena::of(p)->marks_[index / 64], __ATOMIC_RELAXED) & bit) != 0;
+}
+
+void Heap::set_live(const void *p) noexcept
+{
+	auto index = Arena::index_of(p);
+	Arena::of(p)->live_[index / 64] |= uint64_t(1) << (index % 64);
+}
+
+void Heap::clear_live(const void *p) noexcept
+{
+	auto index = Arena::index_of(p);
+	Arena::of(p)->live_[index / 64] &= ~(uint64_t(1) << (index % 64));
+}
+
+void Heap::clear_marks()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		std::memset(arena->marks_, 0, sizeof(arena->marks_));
+}
+
+double Heap::occupancy()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t live = 0, capacity = 0;
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		if (!arena->is_large())
+		{
+			live += arena->live_count() * arena->slot_size_;
+			capacity += arena->slot_count_ * arena->slot_size_;
+		}
+	return capacity == 0 ? 1.0 : double(live) / capacity;
+}
+
+size_t Heap::live_bytes()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t live = 0;
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		live += arena->is_large() ? arena->live_count() * arena->large_size_
+								  : arena->live_count() * arena->slot_size_;
+	return live;
+}
+
+std::vector<Arena *> Heap::begin_evacuation(double threshold)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<Arena *> sparse;
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		if (!arena->is_large() && arena->live_count() < arena->slot_count_ * threshold)
+			sparse.push_back(arena);
+	// a size class with a single sparse arena has nothing to gain from moving
+	std::vector<size_t> per_class(classes_.size());
+	for (auto arena : sparse)
+		per_class[class_of(arena->slot_size_)]++;
+	sparse.erase(std::remove_if(sparse.begin(), sparse.end(), [&](Arena *arena)
+								{ return per_class[class_of(arena->slot_size_)] < 2; }),
+				 sparse.end());
+	for (auto arena : sparse)
+	{
+		arena->evacuating_ = true;
+		auto &sizeClass = classes_[class_of(arena->slot_size_)];
+		if (sizeClass.current_ == arena)
+			sizeClass.current_ = nullptr;
+		auto it = std::find(sizeClass.partial_.begin(), sizeClass.partial_.end(), arena);
+		if (it != sizeClass.partial_.end())
+			sizeClass.partial_.erase(it);
+	}
+	return sparse;
+}
+
+void Heap::end_evacuation()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	// arenas emptied by the evacuation are gone already, the rest held pinned objects
+	for (auto arena = arenas_; arena != nullptr; arena = arena->next_)
+		if (arena->evacuating_)
+		{
+			arena->evacuating_ = false;
+			if (arena->used_ < arena->slot_count_)
+				classes_[class_of(arena->slot_size_)].partial_.push_back(arena);
+		}
+}
@@ -0,0 +1,673 @@
+#include "json.hpp"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <unistd.h>
+#include "memory.hpp"
+#include "object.hpp"
+#include "objstring.hpp"
+#include "vm.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	constexpr size_t BLOCK = 64;
+
+	// one bit per byte of a block
+	struct Masks
+	{
+		uint64_t quote_ = 0;
+		uint64_t backslash_ = 0;
+		uint64_t op_ = 0; // {}[]:,
+		uint64_t space_ = 0;
+	};
+
+#if defined(__SSE2__)
+	uint64_t movemask(__m128i eq, int chunk)
+	{
+		return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq))) << (16 * chunk);
+	}
+
+	Masks classify(const char *p)
+	{
+		Masks m;
+		for (int i = 0; i < 4; i++)
+		{
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+			auto eq = [v](char c)
+			{ return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); };
+			// [ and ] are { and } with the 0x20 bit cleared
+			auto folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+			auto brackets = _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')));
+			m.op_ |= movemask(_mm_or_si128(brackets, _mm_or_si128(eq(':'), eq(','))), i);
+			m.space_ |= movemask(_mm_or_si128(_mm_or_si128(eq(' '), eq('\t')), _mm_or_si128(eq('\n'), eq('\r'))), i);
+			m.quote_ |= movemask(eq('"'), i);
+			m.backslash_ |= movemask(eq('\\'), i);
+		}
+		return m;
+	}
+#else
+	Masks classify(const char *p)
+	{
+		Masks m;
+		for (size_t i = 0; i < BLOCK; i++)
+		{
+			auto bit = uint64_t(1) << i;
+			switch (p[i])
+			{
+			case '{':
+			case '}':
+			case '[':
+			case ']':
+			case ':':
+			case ',':
+				m.op_ |= bit;
+				break;
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				m.space_ |= bit;
+				break;
+			case '"':
+				m.quote_ |= bit;
+				break;
+			case '\\':
+				m.backslash_ |= bit;
+				break;
+			}
+		}
+		return m;
+	}
+#endif
+
+	// bit i is the parity of bits 0..i
+	uint64_t prefix_xor(uint64_t x)
+	{
+		x ^= x << 1;
+		x ^= x << 2;
+		x ^= x << 4;
+		x ^= x << 8;
+		x ^= x << 16;
+		x ^= x << 32;
+		return x;
+	}
+
+	// the bytes preceded by an odd run of backslashes. carry says whether the first
+	// byte of the next block is escaped
+	uint64_t find_escaped(uint64_t backslash, uint64_t &carry)
+	{
+		constexpr uint64_t EVEN_BITS = 0x5555555555555555ULL;
+		backslash &= ~carry;
+		auto follows_escape = backslash << 1 | carry;
+		auto odd_starts = backslash & ~EVEN_BITS & ~follows_escape;
+		uint64_t even_starts;
+		carry = __builtin_add_overflow(odd_starts, backslash, &even_starts);
+		auto invert = even_starts << 1;
+		return (EVEN_BITS ^ invert) & follows_escape;
+	}
+
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	bool is_op(char c)
+	{
+		return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+	}
+
+	void append_utf8(std::string &out, uint32_t code)
+	{
+		if (code < 0x80)
+			out += static_cast<char>(code);
+		else if (code < 0x800)
+		{
+			out += static_cast<char>(0xC0 | code >> 6);
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			out += static_cast<char>(0xE0 | code >> 12);
+			out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			out += static_cast<char>(0xF0 | code >> 18);
+			out += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+			out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+
+	class Builder
+	{
+	public:
+		Builder(std::string_view text, VM &vm) : text_(text), vm_(vm), index_(json::structural_index(text)) {}
+
+		Value parse();
+
+	private:
+		struct Frame
+		{
+			Obj *container_;
+			bool object_;
+			uint32_t filled_;
+		};
+
+		[[noreturn]] void fail(const char *what, size_t at) const
+		{
+			throw NativeError(std::string(what) + " at " + std::to_string(at) + ".");
+		}
+		uint32_t next()
+		{
+			if (pos_ == index_.size())
+				fail("Unexpected end of input", text_.size());
+			return index_[pos_++];
+		}
+		bool delimited(size_t end) const
+		{
+			return end == text_.size() || is_space(text_[end]) || is_op(text_[end]);
+		}
+
+		void count_elements();
+		Value begin(uint32_t at);
+		ObjString *string(uint32_t at);
+		uint32_t hex4(size_t at) const;
+		Value number(uint32_t at) const;
+		Value literal(uint32_t at) const;
+
+		std::string_view text_;
+		VM &vm_;
+		std::vector<uint32_t> index_;
+		std::vector<uint32_t> counts_; // elements of the container opened at index_[i]
+		std::vector<Frame> stack_;	   // open containers, innermost last
+		size_t pos_ = 0;
+		std::string scratch_; // strings with escapes are unescaped here
+	};
+
+	// one pass over the index gives every container its size before it is built
+	void Builder::count_elements()
+	{
+		counts_.assign(index_.size(), 0);
+		std::vector<uint32_t> open;
+		for (uint32_t i = 0; i < index_.size(); i++)
+			switch (text_[index_[i]])
+			{
+			case '{':
+			case '[':
+				open.push_back(i);
+				break;
+			case ',':
+				if (!open.empty())
+					counts_[open.back()]++;
+				break;
+			case '}':
+			case ']':
+				// mismatches are left to parse()
+				if (open.empty())
+					return;
+				if (i != open.back() + 1)
+					counts_[open.back()]++;
+				open.pop_back();
+				break;
+			}
+		// unclosed ones still get room for what they hold, parse() fails at the end
+		for (auto i : open)
+			if (i + 1 != index_.size())
+				counts_[i]++;
+	}
+
+	// Every object is reachable from the moment it is created: the root through the
+	// pinned roots array, the rest through the container they are stored into before
+	// anything else allocates. A key is held in the roots array until it is inserted.
+	Value Builder::parse()
+	{
+		count_elements();
+		Pinned<ObjArray> roots(vm_.gc_, create_obj<ObjArray>(vm_.gc_, 2));
+		auto &root = roots->values_[0];
+		auto &key = roots->values_[1];
+
+		root = begin(next());
+		while (!stack_.empty())
+		{
+			auto &frame = stack_.back();
+			auto at = next();
+			auto c = text_[at];
+			if (c == (frame.object_ ? '}' : ']'))
+			{
+				if (!frame.object_)
+					static_cast<ObjArray *>(frame.container_)->pack();
+				stack_.pop_back();
+				continue;
+			}
+			if (frame.filled_ > 0)
+			{
+				if (c != ',')
+					fail(frame.object_ ? "Expected ',' or '}'" : "Expected ',' or ']'", at);
+				at = next();
+				c = text_[at];
+			}
+			auto index = frame.filled_++;
+			// begin() may push a frame, so frame is not used past here
+			if (frame.object_)
+			{
+				auto json = static_cast<ObjJson *>(frame.container_);
+				if (c != '"')
+					fail("Expected a key", at);
+				key = string(at);
+				auto slot = &json->kv_[key];
+				at = next();
+				if (text_[at] != ':')
+					fail("Expected ':'", at);
+				*slot = begin(next());
+			}
+			else
+			{
+				auto array = static_cast<ObjArray *>(frame.container_);
+				if (index >= array->values_.size())
+					fail("Unexpected character", at);
+				auto value = begin(at);
+				array->values_[index] = value;
+			}
+		}
+		if (pos_ != index_.size())
+			fail("Unexpected character", index_[pos_]);
+		return root;
+	}
+
+	// a scalar, or a new container that the caller stores before it allocates again
+	Value Builder::begin(uint32_t at)
+	{
+		switch (text_[at])
+		{
+		case '{':
+		{
+			auto json = create_obj<ObjJson>(vm_.gc_, counts_[pos_ - 1]);
+			stack_.push_back({json, true, 0});
+			return json;
+		}
+		case '[':
+		{
+			auto array = create_obj<ObjArray>(vm_.gc_, static_cast<int>(counts_[pos_ - 1]));
+			stack_.push_back({array, false, 0});
+			return array;
+		}
+		case '"':
+			return string(at);
+		case 't':
+		case 'f':
+		case 'n':
+			return literal(at);
+		default:
+			return number(at);
+		}
+	}
+
+	ObjString *Builder::string(uint32_t at)
+	{
+		size_t i = at + 1;
+		for (;; i++)
+		{
+			if (i == text_.size())
+				fail("Unterminated string", at);
+			auto c = static_cast<unsigned char>(text_[i]);
+			if (c == '"')
+				return create_obj_string(text_.substr(at + 1, i - at - 1), vm_);
+			if (c == '\\')
+				break;
+			if (c < 0x20)
+				fail("Control character in string", i);
+		}
+
+		scratch_.assign(text_.data() + at + 1, i - at - 1);
+		while (true)
+		{
+			if (i == text_.size())
+				fail("Unterminated string", at);
+			auto c = static_cast<unsigned char>(text_[i]);
+			if (c == '"')
+				break;
+			if (c < 0x20)
+				fail("Control character in string", i);
+			i++;
+			if (c != '\\')
+			{
+				scratch_ += static_cast<char>(c);
+				continue;
+			}
+			if (i == text_.size())
+				fail("Unterminated string", at);
+			switch (text_[i++])
+			{
+			case '"':
+				scratch_ += '"';
+				break;
+			case '\\':
+				scratch_ += '\\';
+				break;
+			case '/':
+				scratch_ += '/';
+				break;
+			case 'b':
+				scratch_ += '\b';
+				break;
+			case 'f':
+				scratch_ += '\f';
+				break;
+			case 'n':
+				scratch_ += '\n';
+				break;
+			case 'r':
+				scratch_ += '\r';
+				break;
+			case 't':
+				scratch_ += '\t';
+				break;
+			case 'u':
+			{
+				auto code = hex4(i);
+				i += 4;
+				if (code >= 0xDC00 && code < 0xE000)
+					fail("Invalid surrogate pair", i - 6);
+				if (code >= 0xD800 && code < 0xDC00)
+				{
+					if (text_.substr(i, 2) != "\\u")
+						fail("Invalid surrogate pair", i - 6);
+					auto low = hex4(i + 2);
+					if (low < 0xDC00 || low >= 0xE000)
+						fail("Invalid surrogate pair", i - 6);
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					i += 6;
+				}
+				append_utf8(scratch_, code);
+				break;
+			}
+			default:
+				fail("Invalid escape", i - 2);
+			}
+		}
+		return create_obj_string(std::string_view(scratch_), vm_);
+	}
+
+	uint32_t Builder::hex4(size_t at) const
+	{
+		uint32_t code = 0;
+		auto digits = text_.substr(at, 4);
+		auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), code, 16);
+		if (digits.size() != 4 || ec != std::errc() || end != digits.data() + 4)
+			fail("Invalid \\u escape", at);
+		return code;
+	}
+
+	Value Builder::number(uint32_t at) const
+	{
+		auto end = at;
+		while (end < text_.size() && !is_space(text_[end]) && !is_op(text_[end]))
+			end++;
+		auto token = text_.substr(at, end - at);
+		auto digits = token.substr(token[0] == '-');
+		// JSON has no leading plus or leading zeros
+		if (digits.empty() || digits[0] < '0' || digits[0] > '9' || (digits[0] == '0' && digits.size() > 1 && digits[1] >= '0' && digits[1] <= '9'))
+			fail("Unexpected character", at);
+		int value;
+		auto [last, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+		if (ec == std::errc::result_out_of_range)
+			fail("Number does not fit in an int", at);
+		if (ec != std::errc() || last != token.data() + token.size())
+			fail("Expected an integer", at);
+		return value;
+	}
+
+	Value Builder::literal(uint32_t at) const
+	{
+		auto is = [this, at](std::string_view word)
+		{ return text_.substr(at, word.size()) == word && delimited(at + word.size()); };
+		if (is("true"))
+			return true;
+		if (is("false"))
+			return false;
+		if (is("null"))
+			return Value();
+		fail("Unexpected character", at);
+	}
+}
+
+std::vector<uint32_t> json::structural_index(std::string_view text)
+{
+	std::vector<uint32_t> index;
+	index.reserve(text.size() / 4 + 1);
+	uint64_t escape_carry = 0, in_string_carry = 0, scalar_carry = 0;
+	char tail[BLOCK];
+	for (size_t base = 0; base < text.size(); base += BLOCK)
+	{
+		auto p = text.data() + base;
+		if (text.size() - base < BLOCK)
+		{
+			// spaces are neutral, a token ending the text still ends
+			std::memset(tail, ' ', BLOCK);
+			std::memcpy(tail, p, text.size() - base);
+			p = tail;
+		}
+		auto m = classify(p);
+		auto quote = m.quote_ & ~find_escaped(m.backslash_, escape_carry);
+		// from an opening quote up to, not including, its closing quote
+		auto in_string = prefix_xor(quote) ^ in_string_carry;
+		in_string_carry = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+		// any other byte run outside strings is a number or a literal, its first byte counts
+		auto scalar = ~(m.op_ | m.space_ | quote);
+		auto scalar_start = scalar & ~(scalar << 1 | scalar_carry);
+		scalar_carry = scalar >> 63;
+		auto structurals = ((m.op_ | scalar_start) & ~in_string) | (quote & in_string);
+		for (; structurals != 0; structurals &= structurals - 1)
+			index.push_back(static_cast<uint32_t>(base + __builtin_ctzll(structurals)));
+	}
+	if (in_string_carry != 0)
+		throw NativeError("Unterminated string.");
+	return index;
+}
+
+Value json::parse(std::string_view text, VM &vm)
+{
+	return Builder(text, vm).parse();
+}
+
+namespace
+{
+	constexpr size_t CYCLE_CHECK_DEPTH = 256; // deeper than this, open containers are tracked to catch cycles
+
+	template <typename Buffer>
+	void write_out(Buffer &out, int fd)
+	{
+		size_t done = 0;
+		while (done < out.size())
+		{
+			auto n = ::write(fd, out.data() + done, out.size() - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0)
+				throw NativeError("Cannot write to file descriptor " + std::to_string(fd) + ": " + std::strerror(errno) + ".");
+			done += n;
+		}
+		out.clear();
+	}
+
+	template <typename Buffer>
+	void write_int(Buffer &out, int value)
+	{
+		char digits[16];
+		auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+		out.append(digits, end);
+	}
+
+	// runs that need no escaping are copied whole
+	template <typename Buffer>
+	void write_string(Buffer &out, std::string_view text)
+	{
+		static constexpr char HEX[] = "0123456789abcdef";
+		out += '"';
+		size_t run = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			auto c = static_cast<unsigned char>(text[i]);
+			if (c >= 0x20 && c != '"' && c != '\\')
+				continue;
+			out.append(text.data() + run, i - run);
+			run = i + 1;
+			switch (c)
+			{
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '\r':
+				out += "\\r";
+				break;
+			case '\t':
+				out += "\\t";
+				break;
+			case '\b':
+				out += "\\b";
+				break;
+			case '\f':
+				out += "\\f";
+				break;
+			default:
+				out += "\\u00";
+				out += HEX[c >> 4];
+				out += HEX[c & 0xF];
+			}
+		}
+		out.append(text.data() + run, text.size() - run);
+		out += '"';
+	}
+
+	// JSON keys are strings, numbers and literals are quoted
+	template <typename Buffer>
+	void write_key(Buffer &out, const Value &key)
+	{
+		if (key.is_obj_type<ObjString>())
+			return write_string(out, key.as_obj<ObjString>()->text());
+		out += '"';
+		if (key.is_number())
+			write_int(out, key.as<int>());
+		else if (key.is_bool())
+			out += key.as<bool>() ? "true" : "false";
+		else if (key.is_nil())
+			out += "null";
+		else
+			throw NativeError("Cannot use a " + std::string(nameof(key.as<Obj *>()->type_)) + " as a JSON key.");
+		out += '"';
+	}
+}
+
+template <typename Buffer>
+void json::stringify(const Value &root, Buffer &out, int fd)
+{
+	struct Frame
+	{
+		const ObjArray *array_; // or json_
+		const ObjJson *json_;
+		size_t index_;
+		decltype(ObjJson::kv_)::const_iterator next_;
+
+		const Obj *container() const { return array_ != nullptr ? static_cast<const Obj *>(array_) : json_; }
+	};
+	std::vector<Frame> stack;
+	std::unordered_set<const Obj *> open;
+
+	// writes scalars and packed arrays, opens the other containers
+	auto value = [&](const Value &v)
+	{
+		if (v.is_nil())
+			out += "null";
+		else if (v.is_bool())
+			out += v.as<bool>() ? "true" : "false";
+		else if (v.is_number())
+			write_int(out, v.as<int>());
+		else if (v.is_obj_type<ObjString>())
+			write_string(out, v.as_obj<ObjString>()->text());
+		else if (v.is_obj_type<ObjArray>() && v.as_obj<ObjArray>()->packed_)
+		{
+			auto &ints = v.as_obj<ObjArray>()->ints_;
+			out += '[';
+			for (size_t i = 0; i < ints.size(); i++)
+			{
+				if (i > 0)
+					out += ',';
+				write_int(out, ints[i]);
+			}
+			out += ']';
+		}
+		else if (v.is_obj_type<ObjArray>() || v.is_obj_type<ObjJson>())
+		{
+			auto obj = v.as<Obj *>();
+			if (stack.size() >= CYCLE_CHECK_DEPTH)
+			{
+				if (open.empty())
+					for (auto &frame : stack)
+						open.insert(frame.container());
+				if (!open.insert(obj).second)
+					throw NativeError("Cannot convert a cyclic structure to JSON.");
+			}
+			if (v.is_obj_type<ObjArray>())
+			{
+				out += '[';
+				stack.push_back({v.as_obj<ObjArray>(), nullptr, 0, {}});
+			}
+			else
+			{
+				out += '{';
+				auto json = v.as_obj<ObjJson>();
+				stack.push_back({nullptr, json, 0, json->kv_.begin()});
+			}
+		}
+		else
+			throw NativeError("Cannot convert a " + std::string(nameof(v.as<Obj *>()->type_)) + " to JSON.");
+	};
+
+	value(root);
+	while (!stack.empty())
+	{
+		if (fd >= 0 && out.size() >= FLUSH_BYTES)
+			write_out(out, fd);
+		// value() may push, so frame is not used after it
+		auto &frame = stack.back();
+		auto done = frame.array_ != nullptr ? frame.index_ == frame.array_->size() : frame.next_ == frame.json_->kv_.end();
+		if (done)
+		{
+			out += frame.array_ != nullptr ? ']' : '}';
+			if (!open.empty())
+				open.erase(frame.container());
+			stack.pop_back();
+			continue;
+		}
+		if (frame.index_++ > 0)
+			out += ',';
+		if (frame.array_ != nullptr)
+			value(frame.array_->at(frame.index_ - 1));
+		else
+		{
+			auto &[key, v] = *frame.next_++;
+			write_key(out, key);
+			out += ':';
+			value(v);
+		}
+	}
+	if (fd >= 0)
+		write_out(out, fd);
+}
+
+template void json::stringify<std::string>(const Value &, std::string &, int);
+template void json::stringify<clox_string>(const Value &, clox_string &, int);
@@ -4,24 +4,261 @@
 #include "objstring.hpp"
 #include "common.hpp"
 #include "vm.hpp"
+#include "profiler.hpp"
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <cstdlib>
 
-constexpr auto GC_HEAP_GROW_FACTOR = 2;
+constexpr size_t MAX_MARKERS = 8;
+constexpr size_t PARALLEL_MARK_THRESHOLD = 64 * 1024; // live objects
+constexpr size_t MARK_SLICE = 4096;						// elements per gray slice
+constexpr size_t COMPACT_MIN_ARENAS = 4;
+constexpr double COMPACT_OCCUPANCY = 0.5; // heap wide, below it a collection asks to compact
+constexpr double EVACUATE_BELOW = 0.5;	  // per arena, sparser arenas are emptied
 
-void GC::collect()
+static const char *const CAUSE_NAMES[] = {"allocation", "soft limit", "explicit"};
+
+GC::GC(VM &vm, const GCConfig &config)
+	: next_gc_(config.initial_heap_), config_(config), vm_(vm), sweeper_(&GC::sweeper_loop, this)
+{
+	auto markers = std::min<size_t>(std::thread::hardware_concurrency(), MAX_MARKERS);
+	mark_workers_.push_back(std::make_unique<MarkWorker>());
+	for (size_t i = 1; i < markers; i++)
+		mark_workers_.push_back(std::make_unique<MarkWorker>());
+	for (size_t i = 1; i < mark_workers_.size(); i++)
+		markers_.emplace_back(&GC::marker_loop, this, mark_workers_[i].get());
+	if (config_.alloc_profile_ != 0)
+		profiler_ = std::make_unique<AllocProfiler>(vm_, config_.alloc_profile_);
+}
+
+void GC::report_exit()
+{
+	if (config_.dump_stats_)
+		dump_stats(std::cerr);
+	if (!config_.snapshot_path_.empty())
+	{
+		try
+		{
+			dump_snapshot(std::cerr, config_.snapshot_path_.c_str());
+		}
+		catch (const NativeError &e)
+		{
+			std::cerr << "heap snapshot: " << e.what() << std::endl;
+		}
+	}
+	if (profiler_ != nullptr)
+		profiler_->report(std::cerr);
+}
+
+GC::~GC()
+{
+	{
+		std::lock_guard<std::mutex> lock(mark_mutex_);
+		markers_stop_ = true;
+	}
+	mark_cv_.notify_all();
+	for (auto &marker : markers_)
+		marker.join();
+	{
+		std::lock_guard<std::mutex> lock(sweep_mutex_);
+		sweeper_stop_ = true;
+	}
+	sweep_cv_.notify_one();
+	sweeper_.join();
+	std::vector<Obj *> remaining;
+	heap_.for_each_live([&remaining](void *p)
+						{ remaining.push_back(static_cast<Obj *>(p)); });
+	for (auto obj : remaining)
+		free_obj(obj);
+}
+
+void *allocate_obj(std::size_t size)
 {
-	if(vm_.current_coroutine_ == nullptr)
-		return ;
-	auto before = bytes_allocated_;
+	auto gc = AllocBase::gc;
+	auto p = gc->heap_.allocate(size);
+#ifdef STRESS_TEST
+	std::cout << "allocate: " << size << std::endl;
+#endif
+	gc->bytes_allocated_ += size;
+	try
+	{
+#ifndef STRESS_TEST
+		if (gc->bytes_allocated_ > gc->next_gc_)
+#endif
+			gc->collect();
+	}
+	catch (const OutOfMemory &)
+	{
+		deallocate_obj(p, size);
+		throw;
+	}
+	return p;
+}
+
+void deallocate_obj(void *p, std::size_t size)
+{
+	auto gc = AllocBase::gc;
+	gc->heap_.deallocate(p, size);
+	gc->bytes_allocated_ -= size;
+}
+
+void GC::collect(GCCause cause)
+{
+	// relocation rebuilds tables, which must not start a collection halfway through
+	if (vm_.current_coroutine_ == nullptr || compacting_)
+		return;
+	if (cause == GCCause::Allocation && soft_limited_)
+		cause = GCCause::SoftLimit;
+	using Clock = std::chrono::steady_clock;
+	auto start = Clock::now();
+	heap_.clear_marks();
+	local_worker_ = mark_workers_[0].get();
 	mark_roots();
+	auto roots_done = Clock::now();
 	trace_references();
+	auto trace_done = Clock::now();
 	remove_white_string();
+	auto strings_done = Clock::now();
 	sweep();
-#ifdef DEBUG_MODE
-	if (before - bytes_allocated_ != 0)
-		std::cout << "gc collect " << before - bytes_allocated_ << " bytes" << std::endl;
-#endif
+	auto sweep_done = Clock::now();
+
+	size_t live = bytes_allocated_;
+	if (config_.max_heap_ != 0 && live > config_.max_heap_)
+	{
+		// garbage still queued for the sweeper counts until it is freed
+		wait_for_sweeper();
+		live = bytes_allocated_;
+	}
+	next_gc_ = std::max(static_cast<size_t>(live * config_.growth_factor_), live + config_.min_interval_);
+	bool over_soft_limit = config_.soft_limit_ != 0 && next_gc_ > config_.soft_limit_;
+	if (over_soft_limit)
+		next_gc_ = std::max(config_.soft_limit_, live + std::max(live / 8, config_.min_interval_));
+	soft_limited_ = over_soft_limit;
+	if (config_.compact_ && heap_.arena_count_ >= COMPACT_MIN_ARENAS &&
+		(over_soft_limit || heap_.occupancy() < COMPACT_OCCUPANCY))
+		compact_requested_ = true;
+
+	auto pause = Clock::now() - start;
+	stats_.collections_++;
+	stats_.causes_[static_cast<size_t>(cause)]++;
+	stats_.roots_ += roots_done - start;
+	stats_.trace_ += trace_done - roots_done;
+	stats_.strings_ += strings_done - trace_done;
+	stats_.sweep_ += sweep_done - strings_done;
+	stats_.total_pause_ += pause;
+	stats_.max_pause_ = std::max(stats_.max_pause_, pause);
+	stats_.last_pause_ = pause;
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(pause).count();
+	size_t bucket = 0;
+	while (bucket + 1 < PAUSE_BUCKETS && (int64_t(1) << bucket) <= us)
+		bucket++;
+	stats_.pauses_[bucket]++;
+	stats_.live_bytes_ = heap_.live_bytes();
+	stats_.live_objects_ = object_count_;
+	if (config_.max_heap_ != 0 && live > config_.max_heap_)
+		throw OutOfMemory("Out of memory: live heap exceeds the max heap size.");
+}
+
+void GC::configure(const GCConfig &config)
+{
+	config_ = config;
+	next_gc_ = std::max(config_.initial_heap_, bytes_allocated_.load());
+	if (!config_.compact_)
+		compact_requested_ = false;
+}
+
+std::optional<size_t> GCConfig::parse_size(std::string_view text)
+{
+	size_t value = 0, i = 0;
+	for (; i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])); i++)
+		value = value * 10 + (text[i] - '0');
+	if (i == 0)
+		return std::nullopt;
+	auto suffix = text.substr(i);
+	if (suffix == "K" || suffix == "k")
+		return value << 10;
+	if (suffix == "M" || suffix == "m")
+		return value << 20;
+	if (suffix == "G" || suffix == "g")
+		return value << 30;
+	if (!suffix.empty())
+		return std::nullopt;
+	return value;
+}
+
+static bool apply_option(GCConfig &config, std::string_view name, std::string_view value)
+{
+	if (name == "growth")
+	{
+		auto factor = std::strtod(std::string(value).c_str(), nullptr);
+		if (factor <= 1.0)
+			return false;
+		config.growth_factor_ = factor;
+		return true;
+	}
+	if (name == "compact" || name == "stats")
+	{
+		(name == "compact" ? config.compact_ : config.dump_stats_) = value != "0" && value != "off" && value != "false";
+		return true;
+	}
+	if (name == "snapshot")
+	{
+		config.snapshot_path_ = value;
+		return !value.empty();
+	}
+	auto size = GCConfig::parse_size(value);
+	if (!size)
+		return false;
+	if (name == "initial-heap")
+		config.initial_heap_ = *size;
+	else if (name == "min-interval")
+		config.min_interval_ = *size;
+	else if (name == "soft-limit")
+		config.soft_limit_ = *size;
+	else if (name == "max-heap")
+		config.max_heap_ = *size;
+	else if (name == "alloc-profile")
+		config.alloc_profile_ = *size;
+	else
+		return false;
+	return true;
+}
 
-	next_gc_ = bytes_allocated_ * GC_HEAP_GROW_FACTOR;
+GCConfig GCConfig::from_env()
+{
+	GCConfig config;
+	std::pair<const char *, const char *> vars[] = {
+		{"LOX_GC_INITIAL_HEAP", "initial-heap"},
+		{"LOX_GC_GROWTH", "growth"},
+		{"LOX_GC_MIN_INTERVAL", "min-interval"},
+		{"LOX_GC_SOFT_LIMIT", "soft-limit"},
+		{"LOX_GC_MAX_HEAP", "max-heap"},
+		{"LOX_GC_COMPACT", "compact"},
+		{"LOX_GC_STATS", "stats"},
+		{"LOX_GC_SNAPSHOT", "snapshot"},
+		{"LOX_GC_ALLOC_PROFILE", "alloc-profile"},
+	};
+	for (auto [var, name] : vars)
+		if (auto value = std::getenv(var); value != nullptr && !apply_option(config, name, value))
+			std::cerr << "Ignoring invalid " << var << "=" << value << std::endl;
+	return config;
+}
+
+// --gc-initial-heap=64M, --gc-growth=1.5, --gc-min-interval=, --gc-soft-limit=,
+// --gc-max-heap=, --gc-compact=off, --gc-stats, --gc-snapshot=heap.folded, --gc-alloc-profile=64K
+bool GCConfig::parse_flag(std::string_view flag)
+{
+	constexpr std::string_view prefix = "--gc-";
+	if (flag.substr(0, prefix.size()) != prefix)
+		return false;
+	flag.remove_prefix(prefix.size());
+	if (flag == "stats")
+		return apply_option(*this, flag, "on");
+	auto eq = flag.find('=');
+	if (eq == std::string_view::npos)
+		return false;
+	return apply_option(*this, flag.substr(0, eq), flag.substr(eq + 1));
 }
 
 void GC::mark_roots()
@@ -43,6 +280,8 @@ void GC::mark_roots()
 	mark_table(vm_.globals_);
 	mark_compiler_roots();
 	mark_object(vm_.init_string_);
+	for (auto &[obj, count] : pins_)
+		mark_object(obj);
 }
 
 void GC::mark_array(const std::vector<Value, Allocator<Value>> &array)
@@ -65,11 +304,10 @@ void GC::mark_object(Obj *const ptr)
 {
 	if (ptr == nullptr)
 		return;
-	if (ptr->is_marked_)
+	// several markers can reach the same object, only the one setting the bit traces it
+	if (!Heap::mark(ptr))
 		return;
-
-	ptr->is_marked_ = true;
-	gray_stack_.push_back(ptr);
+	push_gray({ptr});
 }
 
 void GC::mark_value(const Value &value)
@@ -89,11 +327,127 @@ void GC::mark_table(const Table &table)
 
 void GC::trace_references()
 {
-	while (!gray_stack_.empty())
+	bool parallel = !markers_.empty() && object_count_ >= PARALLEL_MARK_THRESHOLD;
+	if (parallel)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mark_mutex_);
+			markers_done_ = 0;
+			mark_generation_++;
+		}
+		mark_cv_.notify_all();
+	}
+	drain(*mark_workers_[0]);
+	if (parallel)
+	{
+		// markers may still be inside a steal attempt, sweeping must wait for them
+		std::unique_lock<std::mutex> lock(mark_mutex_);
+		mark_done_cv_.wait(lock, [this]
+						   { return markers_done_ == markers_.size(); });
+	}
+}
+
+void GC::marker_loop(MarkWorker *worker)
+{
+	local_worker_ = worker;
+	size_t seen = 0;
+	std::unique_lock<std::mutex> lock(mark_mutex_);
+	while (true)
+	{
+		mark_cv_.wait(lock, [this, &seen]
+					  { return markers_stop_ || mark_generation_ != seen; });
+		if (markers_stop_)
+			return;
+		seen = mark_generation_;
+		lock.unlock();
+		drain(*worker);
+		lock.lock();
+		if (++markers_done_ == markers_.size())
+			mark_done_cv_.notify_one();
+	}
+}
+
+void GC::drain(MarkWorker &worker)
+{
+	GrayItem item;
+	while (true)
+	{
+		if (pop_gray(worker, item) || steal_gray(worker, item))
+		{
+			if (item.end_ == 0)
+				blacken_object(item.obj_);
+			else
+				blacken_slice(item);
+			// children were counted before this item is retired, so zero means marking is done
+			gray_count_.fetch_sub(1, std::memory_order_acq_rel);
+		}
+		else if (gray_count_.load(std::memory_order_acquire) == 0)
+			return;
+		else
+			std::this_thread::yield();
+	}
+}
+
+void GC::push_gray(const GrayItem &item)
+{
+	gray_count_.fetch_add(1, std::memory_order_acq_rel);
+	std::lock_guard<std::mutex> lock(local_worker_->mutex_);
+	local_worker_->stack_.push_back(item);
+}
+
+bool GC::pop_gray(MarkWorker &worker, GrayItem &item)
+{
+	std::lock_guard<std::mutex> lock(worker.mutex_);
+	if (worker.stack_.empty())
+		return false;
+	item = worker.stack_.back();
+	worker.stack_.pop_back();
+	return true;
+}
+
+bool GC::steal_gray(MarkWorker &thief, GrayItem &item)
+{
+	std::vector<GrayItem> loot;
+	for (auto &victim : mark_workers_)
 	{
-		auto obj = gray_stack_.front();
-		blacken_object(obj);
-		gray_stack_.pop_front();
+		if (victim.get() == &thief)
+			continue;
+		{
+			std::lock_guard<std::mutex> lock(victim->mutex_);
+			auto &stack = victim->stack_;
+			if (stack.empty())
+				continue;
+			// take the older half, it is the part of the graph the victim will reach last
+			auto half = stack.begin() + (stack.size() + 1) / 2;
+			loot.assign(stack.begin(), half);
+			stack.erase(stack.begin(), half);
+		}
+		// never hold two worker locks at once, two thieves could rob each other
+		item = loot.back();
+		loot.pop_back();
+		std::lock_guard<std::mutex> lock(thief.mutex_);
+		thief.stack_.insert(thief.stack_.end(), loot.begin(), loot.end());
+		return true;
+	}
+	return false;
+}
+
+void GC::blacken_slice(const GrayItem &item)
+{
+	if (item.obj_->type_ == ObjType::Array)
+	{
+		auto &values = static_cast<ObjArray *>(item.obj_)->values_;
+		for (auto i = item.begin_; i < item.end_; i++)
+			mark_value(values[i]);
+	}
+	else
+	{
+		auto entries = static_cast<ObjJson *>(item.obj_)->kv_.begin();
+		for (auto i = item.begin_; i < item.end_; i++)
+		{
+			mark_value(entries[i].key_);
+			mark_value(entries[i].value_);
+		}
 	}
 }
 
@@ -128,6 +482,9 @@ void GC::blacken_object(Obj *ptr)
 		auto function = static_cast<ObjFunction *>(ptr);
 		mark_object(function->name_);
 		mark_array(function->chunk_.constants_);
+		for (const auto &table : function->chunk_.switches_)
+			for (const auto &[label, _] : table.cases_)
+				mark_value(label);
 		break;
 	}
 	case ObjType::Instance:
@@ -135,6 +492,8 @@ void GC::blacken_object(Obj *ptr)
 		auto instance = static_cast<ObjInstance *>(ptr);
 		mark_object(instance->objClass_);
 		mark_table(instance->fields_);
+		for (auto [method, bound] : instance->bound_methods_)
+			mark_object(bound);
 		break;
 	}
 	case ObjType::Upvalue:
@@ -144,18 +503,29 @@ void GC::blacken_object(Obj *ptr)
 	}
 	case ObjType::Array:
 	{
+		// packed ints hold no references
 		auto arrayPtr = static_cast<ObjArray *>(ptr);
-		mark_array(arrayPtr->values_);
+		auto size = arrayPtr->values_.size();
+		if (size <= MARK_SLICE)
+			mark_array(arrayPtr->values_);
+		else
+			for (size_t begin = 0; begin < size; begin += MARK_SLICE)
+				push_gray({ptr, begin, std::min(begin + MARK_SLICE, size)});
 		break;
 	}
 	case ObjType::Json:
 	{
 		auto jsonPtr = static_cast<ObjJson *>(ptr);
-		for (const auto &[k, v] : jsonPtr->kv_)
-		{
-			mark_value(k);
-			mark_value(v);
-		}
+		auto size = jsonPtr->kv_.size();
+		if (size <= MARK_SLICE)
+			for (const auto &[k, v] : jsonPtr->kv_)
+			{
+				mark_value(k);
+				mark_value(v);
+			}
+		else
+			for (size_t begin = 0; begin < size; begin += MARK_SLICE)
+				push_gray({ptr, begin, std::min(begin + MARK_SLICE, size)});
 		break;
 	}
 	case ObjType::Coroutine:
@@ -173,8 +543,15 @@ void GC::blacken_object(Obj *ptr)
 		}
 		break;
 	}
-	case ObjType::Native:
 	case ObjType::String:
+	{
+		auto str = static_cast<ObjString *>(ptr);
+		if (str->slice_)
+			mark_object(static_cast<ObjSlice *>(str)->parent_);
+		break;
+	}
+	case ObjType::Native:
+	case ObjType::StringBuilder:
 		break;
 	default:
 		break;
@@ -183,50 +560,433 @@ void GC::blacken_object(Obj *ptr)
 
 void GC::remove_white_string() noexcept
 {
-	for (auto it = strings_.begin(); it != strings_.end();)
+	strings_.remove_if([this](ObjString *str)
+					   { return !is_marked(str); });
+}
+
+void GC::sweep()
+{
+	std::vector<Obj *> garbage;
+	heap_.for_each_unmarked([this, &garbage](void *p)
+							{
+		auto obj = static_cast<Obj *>(p);
+		auto type = static_cast<size_t>(obj->type_);
+		stats_.freed_objects_[type]++;
+		stats_.freed_bytes_[type] += obj_size(obj);
+		garbage.push_back(obj); });
+	object_count_ -= garbage.size();
+#ifdef DEBUG_MODE
+	if (!garbage.empty())
+		std::cout << "gc sweep " << garbage.size() << " objects" << std::endl;
+#endif
+	if (!garbage.empty())
+		hand_off(std::move(garbage));
+}
+
+void GC::hand_off(std::vector<Obj *> &&garbage)
+{
 	{
-		if (*it != nullptr && !(*it)->is_marked_)
-			it = strings_.erase(it);
-		else
-			++it;
+		std::lock_guard<std::mutex> lock(sweep_mutex_);
+		sweep_queue_.push_back(std::move(garbage));
 	}
+	sweep_cv_.notify_one();
 }
 
-void GC::sweep()
+void GC::sweeper_loop()
 {
-	Obj *previous = nullptr;
-	Obj *object = objects_.get();
-	while (object != nullptr)
+	std::unique_lock<std::mutex> lock(sweep_mutex_);
+	while (true)
 	{
-		if (object->is_marked_)
-		{
-			object->is_marked_ = false;
-			previous = object;
-			object = object->next_.get();
-		}
-		else
+		sweep_cv_.wait(lock, [this]
+					   { return sweeper_stop_ || !sweep_queue_.empty(); });
+		if (sweep_queue_.empty())
+			return;
+		auto batches = std::move(sweep_queue_);
+		sweep_queue_.clear();
+		sweeper_busy_ = true;
+		lock.unlock();
+		for (auto &batch : batches)
+			for (auto obj : batch)
+				free_obj(obj);
+		lock.lock();
+		sweeper_busy_ = false;
+		sweep_idle_cv_.notify_all();
+	}
+}
+
+void GC::wait_for_sweeper()
+{
+	std::unique_lock<std::mutex> lock(sweep_mutex_);
+	sweep_idle_cv_.wait(lock, [this]
+						{ return sweep_queue_.empty() && !sweeper_busy_; });
+}
+
+void GC::pin(Obj *ptr)
+{
+	pins_[ptr]++;
+}
+
+void GC::unpin(Obj *ptr)
+{
+	auto it = pins_.find(ptr);
+	if (it != pins_.end() && --it->second == 0)
+		pins_.erase(it);
+}
+
+// Survivors of sparse arenas are moved into the dense ones, then every reference the
+// VM can reach is rewritten through forward_. Coroutines stay put: run() keeps raw
+// pointers to them and to their frames across dispatch iterations.
+void GC::compact()
+{
+	compact_requested_ = false;
+	// the sweeper must not free into an arena while its survivors are moving out
+	wait_for_sweeper();
+	auto sparse = heap_.begin_evacuation(EVACUATE_BELOW);
+	if (sparse.empty())
+		return;
+
+	compacting_ = true;
+	std::vector<Obj *> movable, live;
+	heap_.for_each_live([&](void *p)
+						{
+		auto obj = static_cast<Obj *>(p);
+		live.push_back(obj);
+		if (Arena::of(p)->evacuating_ && obj->type_ != ObjType::Coroutine && pins_.count(obj) == 0)
+			movable.push_back(obj); });
+#ifdef DEBUG_MODE
+	size_t arenas = heap_.arena_count_;
+#endif
+	for (auto obj : movable)
+		forward_.emplace(obj, relocate(obj));
+	stats_.compactions_++;
+	stats_.moved_objects_ += movable.size();
+	for (auto &obj : live)
+		fix(obj);
+
+	for (auto obj : live)
+		fix_fields(obj);
+	fix_table(vm_.globals_);
+	fix(vm_.init_string_);
+	fix(vm_.open_upvalues_);
+	for (auto compiler = vm_.cu_.current_.get(); compiler != nullptr; compiler = compiler->enclosing_.get())
+		fix(compiler->function_);
+	decltype(vm_.cu_.global_table_) global_table;
+	for (auto name : vm_.cu_.global_table_)
+	{
+		fix(name);
+		global_table.insert(name);
+	}
+	vm_.cu_.global_table_.swap(global_table);
+	strings_.for_each([this](ObjString *&str)
+					  { fix(str); });
+
+	heap_.end_evacuation();
+#ifdef DEBUG_MODE
+	std::cout << "gc compact " << movable.size() << " objects, "
+			  << arenas << " -> " << heap_.arena_count_ << " arenas" << std::endl;
+#endif
+	forward_.clear();
+	compacting_ = false;
+}
+
+template <typename T>
+T *GC::move_obj(T *from)
+{
+	auto to = static_cast<T *>(heap_.allocate(sizeof(T)));
+	new (to) T(std::move(*from));
+	Heap::set_live(to);
+	Heap::clear_live(from);
+	from->~T();
+	heap_.deallocate(from, sizeof(T));
+	return to;
+}
+
+Obj *GC::relocate(Obj *ptr)
+{
+	switch (ptr->type_)
+	{
+	case ObjType::BoundMethod:
+		return move_obj(static_cast<ObjBoundMethod *>(ptr));
+	case ObjType::Class:
+		return move_obj(static_cast<ObjClass *>(ptr));
+	case ObjType::Closure:
+		return move_obj(static_cast<ObjClosure *>(ptr));
+	case ObjType::Function:
+		return move_obj(static_cast<ObjFunction *>(ptr));
+	case ObjType::Instance:
+		return move_obj(static_cast<ObjInstance *>(ptr));
+	case ObjType::Native:
+		return move_obj(static_cast<ObjNative *>(ptr));
+	case ObjType::String:
+	{
+		// the bytes follow the header, so the block is copied whole
+		auto size = static_cast<ObjString *>(ptr)->size();
+		auto to = heap_.allocate(size);
+		std::memcpy(to, ptr, size);
+		Heap::set_live(to);
+		Heap::clear_live(ptr);
+		heap_.deallocate(ptr, size);
+		return static_cast<Obj *>(to);
+	}
+	case ObjType::Upvalue:
+	{
+		// a closed upvalue points at its own closed_ slot, which moves with it
+		auto upvalue = static_cast<ObjUpvalue *>(ptr);
+		bool closed = upvalue->location_ == &upvalue->closed_;
+		auto moved = move_obj(upvalue);
+		if (closed)
+			moved->location_ = &moved->closed_;
+		return moved;
+	}
+	case ObjType::Array:
+		return move_obj(static_cast<ObjArray *>(ptr));
+	case ObjType::Json:
+		return move_obj(static_cast<ObjJson *>(ptr));
+	case ObjType::StringBuilder:
+		return move_obj(static_cast<ObjStringBuilder *>(ptr));
+	default:
+		return ptr;
+	}
+}
+
+template <typename T>
+void GC::fix(T *&ptr)
+{
+	auto it = forward_.find(ptr);
+	if (it != forward_.end())
+		ptr = static_cast<T *>(it->second);
+}
+
+void GC::fix_value(Value &value)
+{
+	if (value.is_obj())
+	{
+		auto obj = value.as<Obj *>();
+		fix(obj);
+		value = obj;
+	}
+}
+
+// keys are ordered by address, so a table holding a moved key is rebuilt
+void GC::fix_table(Table &table)
+{
+	Table fixed;
+	for (auto &[k, v] : table)
+	{
+		auto key = k;
+		auto value = v;
+		fix(key);
+		fix_value(value);
+		fixed.emplace(key, value);
+	}
+	table.swap(fixed);
+}
+
+void GC::fix_bound_methods(BoundMethods &bound_methods)
+{
+	BoundMethods fixed;
+	for (auto [k, v] : bound_methods)
+	{
+		auto method = k;
+		auto bound = v;
+		fix(method);
+		fix(bound);
+		fixed.emplace(method, bound);
+	}
+	bound_methods.swap(fixed);
+}
+
+void GC::fix_fields(Obj *ptr)
+{
+	switch (ptr->type_)
+	{
+	case ObjType::BoundMethod:
+	{
+		auto bound = static_cast<ObjBoundMethod *>(ptr);
+		fix_value(bound->receiver_);
+		fix(bound->method_);
+		break;
+	}
+	case ObjType::Class:
+	{
+		auto objClass = static_cast<ObjClass *>(ptr);
+		fix(objClass->name_);
+		fix_table(objClass->methods_);
+		break;
+	}
+	case ObjType::Closure:
+	{
+		auto closure = static_cast<ObjClosure *>(ptr);
+		fix(closure->function_);
+		for (auto &upvalue : closure->upvalues_)
+			fix(upvalue);
+		break;
+	}
+	case ObjType::String:
+	{
+		auto str = static_cast<ObjString *>(ptr);
+		if (str->slice_)
+			fix(static_cast<ObjSlice *>(str)->parent_);
+		break;
+	}
+	case ObjType::Function:
+	{
+		auto function = static_cast<ObjFunction *>(ptr);
+		fix(function->name_);
+		for (auto &constant : function->chunk_.constants_)
+			fix_value(constant);
+		// hashed by address like Json keys
+		for (auto &table : function->chunk_.switches_)
 		{
-			decltype(object->next_) temp = std::move(object->next_);
-			if (previous == nullptr)
-			{
-				objects_ = std::move(temp);
-				object = objects_.get();
-			}
-			else
+			decltype(table.cases_) cases;
+			for (const auto &[label, target] : table.cases_)
 			{
-				previous->next_ = std::move(temp);
-				object = previous->next_.get();
+				auto fixed = label;
+				fix_value(fixed);
+				cases.emplace(fixed, target);
 			}
+			table.cases_.swap(cases);
 		}
+		break;
 	}
+	case ObjType::Instance:
+	{
+		auto instance = static_cast<ObjInstance *>(ptr);
+		fix(instance->objClass_);
+		fix_table(instance->fields_);
+		fix_bound_methods(instance->bound_methods_);
+		break;
+	}
+	case ObjType::Upvalue:
+	{
+		auto upvalue = static_cast<ObjUpvalue *>(ptr);
+		fix_value(upvalue->closed_);
+		fix(upvalue->next_);
+		break;
+	}
+	case ObjType::Array:
+	{
+		for (auto &value : static_cast<ObjArray *>(ptr)->values_)
+			fix_value(value);
+		break;
+	}
+	case ObjType::Json:
+	{
+		// hashed by address like tables are ordered by it
+		auto &kv = static_cast<ObjJson *>(ptr)->kv_;
+		for (auto &[k, v] : kv)
+		{
+			fix_value(k);
+			fix_value(v);
+		}
+		kv.rehash();
+		break;
+	}
+	case ObjType::Coroutine:
+	{
+		auto coPtr = static_cast<ObjCoroutine *>(ptr);
+		fix(coPtr->closure_);
+		for (int i = 0; i < coPtr->top_; i++)
+			fix_value(coPtr->stack_[i]);
+		for (auto &arg : coPtr->arguments_)
+			fix_value(arg);
+		for (int i = 0; i < coPtr->frame_count_; i++)
+			fix(coPtr->frames_[i].closure_);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+ObjString *GC::find_string(std::string_view str, uint32_t hash) const
+{
+	return strings_.find(str, hash);
+}
+
+void GC::json_set(ObjJson *json, std::string_view key, const Value &value)
+{
+	// the key may be new and inserting allocates, so it is pinned until it is reachable
+	Pinned<ObjString> name(*this, create_obj_string(key, vm_));
+	json->kv_.insert_or_assign(name.get(), value);
 }
 
-ObjString *GC::find_string(const std::string_view &str) const
+ObjJson *GC::json_child(ObjJson *json, std::string_view key)
 {
-	if (auto res = std::find_if(strings_.cbegin(), strings_.cend(),
-								[&str](const auto &it)
-								{ return it->content_ == str; });
-		res != strings_.end())
-		return *res;
-	return nullptr;
-}
\ No newline at end of file
+	Pinned<ObjJson> child(*this, create_obj<ObjJson>(*this));
+	json_set(json, key, child.get());
+	return child.get();
+}
+
+static int64_t to_us(GCStats::Duration duration)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+// Values hold an int, counters past INT_MAX saturate
+static Value saturate(int64_t n)
+{
+	return static_cast<int>(std::min<int64_t>(n, std::numeric_limits<int>::max()));
+}
+
+ObjJson *GC::stats_json()
+{
+	// every object built here is pinned until it hangs off the pinned root
+	Pinned<ObjJson> root(*this, create_obj<ObjJson>(*this));
+	auto set = [this](ObjJson *json, std::string_view key, const Value &value)
+	{ json_set(json, key, value); };
+	auto child = [&](std::string_view key)
+	{ return json_child(root.get(), key); };
+
+	set(root.get(), "collections", saturate(stats_.collections_));
+	auto causes = child("causes");
+	for (size_t i = 0; i < stats_.causes_.size(); i++)
+		set(causes, CAUSE_NAMES[i], saturate(stats_.causes_[i]));
+	auto phases = child("phases");
+	set(phases, "roots", saturate(to_us(stats_.roots_)));
+	set(phases, "trace", saturate(to_us(stats_.trace_)));
+	set(phases, "strings", saturate(to_us(stats_.strings_)));
+	set(phases, "sweep", saturate(to_us(stats_.sweep_)));
+	set(root.get(), "totalPause", saturate(to_us(stats_.total_pause_)));
+	set(root.get(), "maxPause", saturate(to_us(stats_.max_pause_)));
+	set(root.get(), "lastPause", saturate(to_us(stats_.last_pause_)));
+	auto pauses = child("pauses");
+	for (size_t i = 0; i < PAUSE_BUCKETS; i++)
+		if (stats_.pauses_[i] != 0)
+			pauses->kv_.insert_or_assign(saturate(int64_t(1) << i), saturate(stats_.pauses_[i]));
+	auto freed_objects = child("freedObjects");
+	auto freed_bytes = child("freedBytes");
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++)
+		if (stats_.freed_objects_[i] != 0)
+		{
+			set(freed_objects, nameof(ObjType(i)), saturate(stats_.freed_objects_[i]));
+			set(freed_bytes, nameof(ObjType(i)), saturate(stats_.freed_bytes_[i]));
+		}
+	set(root.get(), "liveBytes", saturate(stats_.live_bytes_));
+	set(root.get(), "liveObjects", saturate(stats_.live_objects_));
+	set(root.get(), "compactions", saturate(stats_.compactions_));
+	set(root.get(), "movedObjects", saturate(stats_.moved_objects_));
+	return root.get();
+}
+
+void GC::dump_stats(std::ostream &os) const
+{
+	os << "gc: " << stats_.collections_ << " collections (";
+	for (size_t i = 0; i < stats_.causes_.size(); i++)
+		os << (i == 0 ? "" : ", ") << CAUSE_NAMES[i] << " " << stats_.causes_[i];
+	os << ")\n";
+	os << "gc: pause total " << to_us(stats_.total_pause_) << "us, max " << to_us(stats_.max_pause_)
+	   << "us, roots " << to_us(stats_.roots_) << "us, trace " << to_us(stats_.trace_)
+	   << "us, strings " << to_us(stats_.strings_) << "us, sweep " << to_us(stats_.sweep_) << "us\n";
+	os << "gc: pauses";
+	for (size_t i = 0; i < PAUSE_BUCKETS; i++)
+		if (stats_.pauses_[i] != 0)
+			os << " <" << (size_t(1) << i) << "us:" << stats_.pauses_[i];
+	os << "\n";
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++)
+		if (stats_.freed_objects_[i] != 0)
+			os << "gc: freed " << stats_.freed_objects_[i] << " " << nameof(ObjType(i)) << " ("
+			   << stats_.freed_bytes_[i] << " bytes)\n";
+	os << "gc: live " << stats_.live_objects_ << " objects, " << stats_.live_bytes_ << " bytes; "
+	   << stats_.compactions_ << " compactions moved " << stats_.moved_objects_ << " objects" << std::endl;
+}
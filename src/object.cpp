@@ -1,13 +1,166 @@
 #include "object.hpp"
+#include <algorithm>
+#include "binding.hpp"
 #include "obj.hpp"
 #include "value.hpp"
 #include "memory.hpp"
 #include "objstring.hpp"
+#include "profiler.hpp"
 
 void register_obj(std::unique_ptr<Obj, ObjDeleter> &&obj, GC &gc)
 {
-	obj->next_ = std::move(gc.objects_);
-	gc.objects_ = std::move(obj);
+	if (gc.profiler_ != nullptr)
+		gc.profiler_->record(obj.get());
+	Heap::set_live(obj.get()); // from now on the sweeper owns it
+	obj.release();
+	gc.object_count_++;
+}
+
+void free_obj(Obj *obj)
+{
+	switch (obj->type_)
+	{
+	case ObjType::BoundMethod:
+		delete_obj(static_cast<ObjBoundMethod *>(obj));
+		break;
+	case ObjType::Class:
+		delete_obj(static_cast<ObjClass *>(obj));
+		break;
+	case ObjType::Closure:
+		delete_obj(static_cast<ObjClosure *>(obj));
+		break;
+	case ObjType::Function:
+		delete_obj(static_cast<ObjFunction *>(obj));
+		break;
+	case ObjType::Instance:
+		delete_obj(static_cast<ObjInstance *>(obj));
+		break;
+	case ObjType::Native:
+		delete_obj(static_cast<ObjNative *>(obj));
+		break;
+	case ObjType::String:
+	{
+		auto str = static_cast<ObjString *>(obj);
+		auto size = str->size();
+		str->~ObjString();
+		deallocate_obj(str, size);
+		break;
+	}
+	case ObjType::Upvalue:
+		delete_obj(static_cast<ObjUpvalue *>(obj));
+		break;
+	case ObjType::Array:
+		delete_obj(static_cast<ObjArray *>(obj));
+		break;
+	case ObjType::Json:
+		delete_obj(static_cast<ObjJson *>(obj));
+		break;
+	case ObjType::Coroutine:
+		delete_obj(static_cast<ObjCoroutine *>(obj));
+		break;
+	case ObjType::StringBuilder:
+		delete_obj(static_cast<ObjStringBuilder *>(obj));
+		break;
+	}
+}
+
+size_t obj_size(ObjType type)
+{
+	switch (type)
+	{
+	case ObjType::BoundMethod:
+		return sizeof(ObjBoundMethod);
+	case ObjType::Class:
+		return sizeof(ObjClass);
+	case ObjType::Closure:
+		return sizeof(ObjClosure);
+	case ObjType::Function:
+		return sizeof(ObjFunction);
+	case ObjType::Instance:
+		return sizeof(ObjInstance);
+	case ObjType::Native:
+		return sizeof(ObjNative);
+	case ObjType::String:
+		return sizeof(ObjString);
+	case ObjType::Upvalue:
+		return sizeof(ObjUpvalue);
+	case ObjType::Array:
+		return sizeof(ObjArray);
+	case ObjType::Json:
+		return sizeof(ObjJson);
+	case ObjType::Coroutine:
+		return sizeof(ObjCoroutine);
+	case ObjType::StringBuilder:
+		return sizeof(ObjStringBuilder);
+	default:
+		return 0;
+	}
+}
+
+size_t obj_size(const Obj *obj)
+{
+	if (obj->type_ == ObjType::String)
+		return static_cast<const ObjString *>(obj)->size();
+	return obj_size(obj->type_);
+}
+
+// std::map and std::unordered_map nodes carry about two pointers besides the pair
+constexpr size_t NODE_OVERHEAD = 2 * sizeof(void *);
+
+static size_t table_footprint(const Table &table)
+{
+	return table.size() * (sizeof(Table::value_type) + NODE_OVERHEAD + sizeof(void *));
+}
+
+size_t obj_footprint(const Obj *obj)
+{
+	auto bytes = obj_size(obj);
+	switch (obj->type_)
+	{
+	case ObjType::Class:
+		return bytes + table_footprint(static_cast<const ObjClass *>(obj)->methods_);
+	case ObjType::Closure:
+		return bytes + static_cast<const ObjClosure *>(obj)->upvalues_.capacity() * sizeof(ObjUpvalue *);
+	case ObjType::Function:
+	{
+		auto &chunk = static_cast<const ObjFunction *>(obj)->chunk_;
+		bytes += chunk.bytecode_.capacity() + chunk.lines_.capacity() * sizeof(chunk.lines_[0]) +
+				 chunk.constants_.capacity() * sizeof(Value) + chunk.switches_.capacity() * sizeof(SwitchTable);
+		for (const auto &table : chunk.switches_)
+			bytes += table.dense_.capacity() * sizeof(int) +
+					 table.cases_.size() * (sizeof(std::pair<const Value, int>) + NODE_OVERHEAD + sizeof(void *));
+		return bytes;
+	}
+	case ObjType::Instance:
+	{
+		auto instance = static_cast<const ObjInstance *>(obj);
+		return bytes + table_footprint(instance->fields_) +
+			   instance->bound_methods_.size() * (sizeof(BoundMethods::value_type) + NODE_OVERHEAD + sizeof(void *));
+	}
+	case ObjType::StringBuilder:
+	{
+		auto &buffer = static_cast<const ObjStringBuilder *>(obj)->buffer_;
+		return buffer.capacity() > 15 ? bytes + buffer.capacity() + 1 : bytes;
+	}
+	case ObjType::Array:
+	{
+		auto array = static_cast<const ObjArray *>(obj);
+		return bytes + array->values_.capacity() * sizeof(Value) + array->ints_.capacity() * sizeof(int);
+	}
+	case ObjType::Json:
+	{
+		auto &kv = static_cast<const ObjJson *>(obj)->kv_;
+		return bytes + kv.capacity() * sizeof(JsonMap::Entry) + kv.index_size() * sizeof(int32_t);
+	}
+	case ObjType::Coroutine:
+	{
+		auto co = static_cast<const ObjCoroutine *>(obj);
+		return bytes + (co->stack_.capacity() + co->arguments_.capacity()) * sizeof(Value) +
+			   co->frames_.capacity() * sizeof(CallFrame);
+	}
+	default:
+		return bytes;
+	}
 }
 
 std::ostream &operator<<(std::ostream &os, const ObjFunction &f)
@@ -52,10 +205,10 @@ std::ostream &operator<<(std::ostream &os, const ObjInstance &ins)
 std::ostream &operator<<(std::ostream &os, const ObjArray &arr)
 {
 	os << "[";
-	int n = arr.values_.size();
+	int n = arr.size();
 	for (int i = 0; i < n; i++)
 	{
-		os << arr.values_[i];
+		os << arr.at(i);
 		if (i != n - 1)
 			os << ", ";
 	}
@@ -63,6 +216,60 @@ std::ostream &operator<<(std::ostream &os, const ObjArray &arr)
 	return os;
 }
 
+Value *JsonMap::find(const Value &key)
+{
+	if (index_.empty())
+		return nullptr;
+	auto slot = index_[probe(key)];
+	return slot == EMPTY ? nullptr : &entries_[slot].value_;
+}
+
+Value &JsonMap::operator[](const Value &key)
+{
+	if (auto value = find(key))
+		return *value;
+	// at most two thirds full
+	if ((entries_.size() + 1) * 3 > index_.size() * 2)
+		resize_index(std::max(MIN_INDEX, index_.size() * 2));
+	auto slot = probe(key);
+	entries_.push_back({key, Value()});
+	index_[slot] = static_cast<int32_t>(entries_.size() - 1);
+	return entries_.back().value_;
+}
+
+void JsonMap::reserve(size_t count)
+{
+	entries_.reserve(count);
+	auto slots = MIN_INDEX;
+	while (count * 3 > slots * 2)
+		slots *= 2;
+	if (slots > index_.size())
+		resize_index(slots);
+}
+
+void JsonMap::rehash()
+{
+	std::fill(index_.begin(), index_.end(), EMPTY);
+	for (size_t i = 0; i < entries_.size(); i++)
+		index_[probe(entries_[i].key_)] = static_cast<int32_t>(i);
+}
+
+size_t JsonMap::probe(const Value &key) const
+{
+	// addresses and small ints vary little in their low bits, the multiply spreads them
+	uint64_t h = std::hash<Value>{}(key) * 0x9E3779B97F4A7C15ULL;
+	auto mask = index_.size() - 1;
+	for (auto slot = (h ^ h >> 32) & mask;; slot = (slot + 1) & mask)
+		if (index_[slot] == EMPTY || entries_[index_[slot]].key_ == key)
+			return slot;
+}
+
+void JsonMap::resize_index(size_t slots)
+{
+	index_.assign(slots, EMPTY);
+	rehash();
+}
+
 std::ostream &operator<<(std::ostream &os, const ObjJson &json)
 {
 	os << "{";
@@ -128,12 +335,103 @@ std::ostream &operator<<(std::ostream &os, const Obj &obj)
 	case ObjType::Coroutine:
 		os << static_cast<const ObjCoroutine &>(obj);
 		break;
+	case ObjType::StringBuilder:
+		os << static_cast<const ObjStringBuilder &>(obj);
+		break;
 	default:
 		throw std::invalid_argument("Unexpected ObjType:: obj puts failed");
 	}
 	return os;
 }
 
+ObjArray::ObjArray(const Value *first, int count)
+	: Obj(ObjType::Array), packed_(std::all_of(first, first + count, [](const Value &v)
+											   { return v.is_number(); }))
+{
+	if (packed_)
+	{
+		ints_.reserve(count);
+		for (int i = 0; i < count; i++)
+			ints_.push_back(first[i].as<int>());
+	}
+	else
+		values_.assign(first, first + count);
+}
+
+void ObjArray::push(const Value &value)
+{
+	if (packed_ && value.is_number())
+		ints_.push_back(value.as<int>());
+	else
+	{
+		unpack();
+		values_.push_back(value);
+	}
+}
+
+Value ObjArray::pop()
+{
+	if (packed_)
+	{
+		auto ret = ints_.back();
+		ints_.pop_back();
+		return ret;
+	}
+	auto ret = values_.back();
+	values_.pop_back();
+	return ret;
+}
+
+void ObjArray::insert(size_t index, const Value &value)
+{
+	if (packed_ && value.is_number())
+		ints_.insert(ints_.begin() + index, value.as<int>());
+	else
+	{
+		unpack();
+		values_.insert(values_.begin() + index, value);
+	}
+}
+
+Value ObjArray::erase(size_t index)
+{
+	if (packed_)
+	{
+		auto ret = ints_.at(index);
+		ints_.erase(ints_.begin() + index);
+		return ret;
+	}
+	auto ret = values_.at(index);
+	values_.erase(values_.begin() + index);
+	return ret;
+}
+
+void ObjArray::unpack()
+{
+	if (!packed_)
+		return;
+	// values_ only holds ints until the switch, so a collection in between is harmless
+	values_.reserve(ints_.size());
+	for (auto i : ints_)
+		values_.push_back(i);
+	packed_ = false;
+	ints_.clear();
+	ints_.shrink_to_fit();
+}
+
+void ObjArray::pack()
+{
+	if (packed_ || !std::all_of(values_.begin(), values_.end(), [](const Value &v)
+								 { return v.is_number(); }))
+		return;
+	ints_.reserve(values_.size());
+	for (auto &value : values_)
+		ints_.push_back(value.as<int>());
+	packed_ = true;
+	values_.clear();
+	values_.shrink_to_fit();
+}
+
 ObjCoroutine::ObjCoroutine(ObjClosure *closure, const std::vector<Value>& arguments)
 	: Obj(ObjType::Coroutine), closure_(closure), stack_(1024), frames_(FRAMES_MAX), frame_count_(0), top_(0), status_(CoroutineStatus::SUSPENDED), arguments_(arguments)
 {
@@ -145,3 +443,14 @@ ObjCoroutine::ObjCoroutine(ObjClosure *closure, const std::vector<Value>& argume
 		stack_[top_++] = *arg;
 	frames_[frame_count_++] = frame;
 }
+
+std::string_view binding::type_name(const Value &value)
+{
+	if (value.is_number())
+		return "number";
+	if (value.is_bool())
+		return "bool";
+	if (value.is_nil())
+		return "nil";
+	return nameof(value.as<Obj *>()->type_);
+}
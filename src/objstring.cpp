@@ -3,6 +3,10 @@
 #include "object.hpp"
 #include "vm.hpp"
 #include <string_view>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <sstream>
 
 template ObjString *create_obj_string(std::string_view &str, VM &vm);
 template ObjString *create_obj_string(std::string_view &&str, VM &vm);
@@ -10,33 +14,108 @@ template ObjString *create_obj_string(std::string_view &&str, VM &vm);
 template <typename T>
 ObjString *create_obj_string(T &&str, VM &vm)
 {
-	auto interned = vm.gc_.find_string(str);
+	std::string_view text(str);
+	auto hash = hash_string(text);
+	auto interned = vm.gc_.find_string(text, hash);
 	if (interned != nullptr)
 		return interned;
 
-	auto p = alloc_unique_obj<ObjString>();
+	auto size = ObjString::size_of(text.size());
+	std::unique_ptr<Obj, ObjDeleter> p(new (allocate_obj(size)) ObjString(text, hash), free_obj);
 	auto res = static_cast<ObjString *>(p.get());
-	if (vm.current_coroutine_ != nullptr)
-		vm.push(res);
-	res->content_ = std::forward<T>(str);
-	vm.gc_.strings_.emplace(res);
+	vm.gc_.strings_.insert(res);
 	register_obj(std::move(p), vm.gc_);
-	if (vm.current_coroutine_ != nullptr)
-		vm.pop();
 	return res;
 }
 
+// below this a copy is no bigger than the slice header
+constexpr size_t MIN_SLICE_LENGTH = sizeof(ObjSlice) - sizeof(ObjString);
+
+ObjString *create_slice(ObjString *str, size_t offset, size_t length, VM &vm)
+{
+	if (offset == 0 && length == str->length_)
+		return str;
+	auto text = str->text().substr(offset, length);
+	if (length < MIN_SLICE_LENGTH)
+		return create_obj_string(text, vm);
+	if (str->slice_)
+	{
+		auto slice = static_cast<ObjSlice *>(str);
+		offset += slice->offset_;
+		str = slice->parent_;
+	}
+	// str is an argument of the calling native, so it stays reachable
+	return create_obj<ObjSlice>(vm.gc_, str, static_cast<uint32_t>(offset), static_cast<uint32_t>(length), hash_string(text));
+}
+
+ObjString *intern(ObjString *str, VM &vm)
+{
+	if (!str->slice_)
+		return str;
+	if (auto interned = vm.gc_.find_string(str->text(), str->hash_); interned != nullptr)
+		return interned;
+	return create_obj_string(str->text(), vm);
+}
+
+// FNV-1a
+uint32_t hash_string(std::string_view text) noexcept
+{
+	uint32_t hash = 2166136261u;
+	for (auto c : text)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+ObjString::ObjString(std::string_view text, uint32_t hash)
+	: Obj(ObjType::String), length_(static_cast<uint32_t>(text.size())), hash_(hash)
+{
+	auto bytes = reinterpret_cast<char *>(this + 1);
+	std::memcpy(bytes, text.data(), text.size());
+	bytes[text.size()] = '\0';
+}
+
 std::ostream &operator<<(std::ostream &os, const ObjString &s)
 {
 	os << "\"" << s.text() << "\"";
 	return os;
 }
 
+void ObjStringBuilder::append(const Value &value)
+{
+	if (value.is_obj_type<ObjString>())
+		buffer_ += value.as_obj<ObjString>()->text();
+	else if (value.is_obj_type<ObjStringBuilder>())
+		buffer_ += value.as_obj<ObjStringBuilder>()->buffer_;
+	else if (value.is_number())
+	{
+		char digits[16];
+		auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value.as<int>());
+		buffer_.append(digits, end);
+	}
+	else
+	{
+		std::ostringstream os;
+		os << value;
+		buffer_ += os.str();
+	}
+}
+
+std::ostream &operator<<(std::ostream &os, const ObjStringBuilder &sb)
+{
+	os << "\"" << std::string_view(sb.buffer_) << "\"";
+	return os;
+}
+
 clox_string operator+(const ObjString &lhs, const ObjString &rhs)
 {
-	return lhs.content_ + rhs.content_;
+	clox_string res(lhs.text());
+	res += rhs.text();
+	return res;
 }
 bool operator==(const ObjString &lhs, const ObjString &rhs)
 {
-	return lhs.content_ == rhs.content_;
+	return lhs.text() == rhs.text();
 }
@@ -0,0 +1,78 @@
+#include "profiler.hpp"
+#include "objstring.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+constexpr size_t REPORT_SITES = 20;
+
+std::string AllocProfiler::current_site() const
+{
+	if (vm_.cu_.current_ != nullptr)
+		return "<compiler>";
+	auto co = vm_.current_coroutine_;
+	if (co == nullptr || co->frame_count_ == 0)
+		return "<vm>";
+	// ip_ is already past the instruction that allocates
+	auto &frame = co->frames_[co->frame_count_ - 1];
+	auto function = frame.closure_->function_;
+	auto &lines = function->chunk_.lines_;
+	auto line = lines.empty() ? 0 : lines[std::clamp<int>(frame.ip_ - 1, 0, lines.size() - 1)];
+	std::string name = function->name_ == nullptr ? "<script>" : std::string(function->name_->text());
+	return name + ":" + std::to_string(line);
+}
+
+void AllocProfiler::sample(const Obj *obj, size_t bytes)
+{
+	auto weight = static_cast<double>(std::max(interval_, bytes));
+	auto &site = sites_[{current_site(), obj->type_}];
+	site.samples_++;
+	site.bytes_ += weight;
+	site.count_ += weight / std::max<size_t>(bytes, 1);
+}
+
+ObjJson *AllocProfiler::top_sites()
+{
+	std::vector<std::pair<std::pair<std::string, ObjType>, Site>> sites(sites_.begin(), sites_.end());
+	std::sort(sites.begin(), sites.end(), [](const auto &a, const auto &b)
+			  { return a.second.bytes_ > b.second.bytes_; });
+
+	auto &gc = vm_.gc_;
+	auto saturate = [](double n)
+	{ return Value(static_cast<int>(std::min<double>(n, std::numeric_limits<int>::max()))); };
+	// keyed by "function:line type" so a site allocating two types shows twice
+	Pinned<ObjJson> root(gc, create_obj<ObjJson>(gc));
+	for (auto &[key, site] : sites)
+	{
+		auto json = gc.json_child(root.get(), key.first + " " + std::string(nameof(key.second)));
+		gc.json_set(json, "bytes", saturate(site.bytes_));
+		gc.json_set(json, "count", saturate(site.count_));
+		gc.json_set(json, "samples", saturate(site.samples_));
+	}
+	return root.get();
+}
+
+void AllocProfiler::report(std::ostream &os) const
+{
+	using Entry = std::pair<const std::pair<std::string, ObjType>, Site>;
+	std::vector<const Entry *> sites;
+	for (auto &entry : sites_)
+		sites.push_back(&entry);
+	auto print = [&](const char *by, auto &&less)
+	{
+		std::sort(sites.begin(), sites.end(), less);
+		os << "alloc: top sites by " << by << ", sampled every " << interval_ << " bytes\n";
+		for (size_t i = 0; i < sites.size() && i < REPORT_SITES; i++)
+		{
+			auto &[key, site] = *sites[i];
+			os << "alloc: " << static_cast<size_t>(site.bytes_) << " bytes " << static_cast<size_t>(site.count_)
+			   << " objects " << key.first << " " << nameof(key.second) << "\n";
+		}
+	};
+	print("bytes", [](const Entry *a, const Entry *b)
+		  { return a->second.bytes_ > b->second.bytes_; });
+	print("count", [](const Entry *a, const Entry *b)
+		  { return a->second.count_ > b->second.count_; });
+	os.flush();
+}
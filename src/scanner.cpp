@@ -37,6 +37,8 @@ Token Scanner::scan_token()
     case ',':
         return make_token(TOKEN_COMMA);
     case '.':
+        if(match('.'))
+            return make_token(TOKEN_DOT_DOT);
         return make_token(TOKEN_DOT);
     case '-':
         if(match('='))
@@ -0,0 +1,304 @@
+#include "simd.hpp"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLOX_X86
+#endif
+
+// unsigned so overflow wraps instead of being undefined
+static int wrap(uint32_t x)
+{
+	return static_cast<int>(x);
+}
+
+namespace scalar
+{
+	static int sum(const int *a, size_t n)
+	{
+		uint32_t acc = 0;
+		for (size_t i = 0; i < n; i++)
+			acc += static_cast<uint32_t>(a[i]);
+		return wrap(acc);
+	}
+
+	static int min(const int *a, size_t n)
+	{
+		return *std::min_element(a, a + n);
+	}
+
+	static int max(const int *a, size_t n)
+	{
+		return *std::max_element(a, a + n);
+	}
+
+	static int dot(const int *a, const int *b, size_t n)
+	{
+		uint32_t acc = 0;
+		for (size_t i = 0; i < n; i++)
+			acc += static_cast<uint32_t>(a[i]) * static_cast<uint32_t>(b[i]);
+		return wrap(acc);
+	}
+
+	static void fill(int *a, size_t n, int value)
+	{
+		std::fill(a, a + n, value);
+	}
+
+	static size_t index_of(const int *a, size_t n, int value)
+	{
+		return std::find(a, a + n, value) - a;
+	}
+
+	static void add(const int *a, const int *b, int *out, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+			out[i] = wrap(static_cast<uint32_t>(a[i]) + static_cast<uint32_t>(b[i]));
+	}
+
+	static void mul(const int *a, const int *b, int *out, size_t n)
+	{
+		for (size_t i = 0; i < n; i++)
+			out[i] = wrap(static_cast<uint32_t>(a[i]) * static_cast<uint32_t>(b[i]));
+	}
+}
+
+#ifdef CLOX_X86
+// each kernel runs whole vectors and leaves the tail to the scalar loop
+namespace sse
+{
+#define SSE __attribute__((target("sse4.1")))
+	constexpr size_t LANES = 4;
+
+	SSE static int horizontal_sum(__m128i v)
+	{
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(v);
+	}
+
+	SSE static __m128i load(const int *p)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	}
+
+	SSE static void store(int *p, __m128i v)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+	}
+
+	SSE static int sum(const int *a, size_t n)
+	{
+		auto acc = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm_add_epi32(acc, load(a + i));
+		return wrap(static_cast<uint32_t>(horizontal_sum(acc)) + static_cast<uint32_t>(scalar::sum(a + i, n - i)));
+	}
+
+	SSE static int min(const int *a, size_t n)
+	{
+		if (n < LANES)
+			return scalar::min(a, n);
+		auto acc = load(a);
+		size_t i = LANES;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm_min_epi32(acc, load(a + i));
+		acc = _mm_min_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_min_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		auto res = _mm_cvtsi128_si32(acc);
+		return i < n ? std::min(res, scalar::min(a + i, n - i)) : res;
+	}
+
+	SSE static int max(const int *a, size_t n)
+	{
+		if (n < LANES)
+			return scalar::max(a, n);
+		auto acc = load(a);
+		size_t i = LANES;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm_max_epi32(acc, load(a + i));
+		acc = _mm_max_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_max_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		auto res = _mm_cvtsi128_si32(acc);
+		return i < n ? std::max(res, scalar::max(a + i, n - i)) : res;
+	}
+
+	SSE static int dot(const int *a, const int *b, size_t n)
+	{
+		auto acc = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm_add_epi32(acc, _mm_mullo_epi32(load(a + i), load(b + i)));
+		return wrap(static_cast<uint32_t>(horizontal_sum(acc)) + static_cast<uint32_t>(scalar::dot(a + i, b + i, n - i)));
+	}
+
+	SSE static void fill(int *a, size_t n, int value)
+	{
+		auto v = _mm_set1_epi32(value);
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			store(a + i, v);
+		scalar::fill(a + i, n - i, value);
+	}
+
+	SSE static size_t index_of(const int *a, size_t n, int value)
+	{
+		auto v = _mm_set1_epi32(value);
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			if (auto mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(load(a + i), v))); mask != 0)
+				return i + __builtin_ctz(mask);
+		return i + scalar::index_of(a + i, n - i, value);
+	}
+
+	SSE static void add(const int *a, const int *b, int *out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			store(out + i, _mm_add_epi32(load(a + i), load(b + i)));
+		scalar::add(a + i, b + i, out + i, n - i);
+	}
+
+	SSE static void mul(const int *a, const int *b, int *out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			store(out + i, _mm_mullo_epi32(load(a + i), load(b + i)));
+		scalar::mul(a + i, b + i, out + i, n - i);
+	}
+#undef SSE
+}
+
+namespace avx2
+{
+#define AVX2 __attribute__((target("avx2")))
+	constexpr size_t LANES = 8;
+
+	AVX2 static __m256i load(const int *p)
+	{
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	}
+
+	AVX2 static void store(int *p, __m256i v)
+	{
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+	}
+
+	AVX2 static int horizontal_sum(__m256i v)
+	{
+		auto x = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+		x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(x);
+	}
+
+	AVX2 static int sum(const int *a, size_t n)
+	{
+		// two accumulators hide the add latency
+		auto acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 2 * LANES <= n; i += 2 * LANES)
+		{
+			acc0 = _mm256_add_epi32(acc0, load(a + i));
+			acc1 = _mm256_add_epi32(acc1, load(a + i + LANES));
+		}
+		auto res = static_cast<uint32_t>(horizontal_sum(_mm256_add_epi32(acc0, acc1)));
+		return wrap(res + static_cast<uint32_t>(sse::sum(a + i, n - i)));
+	}
+
+	AVX2 static int min(const int *a, size_t n)
+	{
+		if (n < LANES)
+			return sse::min(a, n);
+		auto acc = load(a);
+		size_t i = LANES;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm256_min_epi32(acc, load(a + i));
+		auto x = _mm_min_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		x = _mm_min_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+		x = _mm_min_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+		auto res = _mm_cvtsi128_si32(x);
+		return i < n ? std::min(res, sse::min(a + i, n - i)) : res;
+	}
+
+	AVX2 static int max(const int *a, size_t n)
+	{
+		if (n < LANES)
+			return sse::max(a, n);
+		auto acc = load(a);
+		size_t i = LANES;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm256_max_epi32(acc, load(a + i));
+		auto x = _mm_max_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		x = _mm_max_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+		x = _mm_max_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+		auto res = _mm_cvtsi128_si32(x);
+		return i < n ? std::max(res, sse::max(a + i, n - i)) : res;
+	}
+
+	AVX2 static int dot(const int *a, const int *b, size_t n)
+	{
+		auto acc = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(load(a + i), load(b + i)));
+		return wrap(static_cast<uint32_t>(horizontal_sum(acc)) + static_cast<uint32_t>(sse::dot(a + i, b + i, n - i)));
+	}
+
+	AVX2 static void fill(int *a, size_t n, int value)
+	{
+		auto v = _mm256_set1_epi32(value);
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			store(a + i, v);
+		sse::fill(a + i, n - i, value);
+	}
+
+	AVX2 static size_t index_of(const int *a, size_t n, int value)
+	{
+		auto v = _mm256_set1_epi32(value);
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			if (auto mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(load(a + i), v))); mask != 0)
+				return i + __builtin_ctz(mask);
+		return i + sse::index_of(a + i, n - i, value);
+	}
+
+	AVX2 static void add(const int *a, const int *b, int *out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			store(out + i, _mm256_add_epi32(load(a + i), load(b + i)));
+		sse::add(a + i, b + i, out + i, n - i);
+	}
+
+	AVX2 static void mul(const int *a, const int *b, int *out, size_t n)
+	{
+		size_t i = 0;
+		for (; i + LANES <= n; i += LANES)
+			store(out + i, _mm256_mullo_epi32(load(a + i), load(b + i)));
+		sse::mul(a + i, b + i, out + i, n - i);
+	}
+#undef AVX2
+}
+#endif
+
+static Kernels select_kernels()
+{
+#ifdef CLOX_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return {"avx2", avx2::sum, avx2::min, avx2::max, avx2::dot, avx2::fill, avx2::index_of, avx2::add, avx2::mul};
+	if (__builtin_cpu_supports("sse4.1"))
+		return {"sse4.1", sse::sum, sse::min, sse::max, sse::dot, sse::fill, sse::index_of, sse::add, sse::mul};
+#endif
+	return {"scalar", scalar::sum, scalar::min, scalar::max, scalar::dot, scalar::fill, scalar::index_of, scalar::add, scalar::mul};
+}
+
+const Kernels &kernels()
+{
+	static const Kernels selected = select_kernels();
+	return selected;
+}
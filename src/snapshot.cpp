@@ -0,0 +1,525 @@
+#include "memory.hpp"
+#include "object.hpp"
+#include "objstring.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <map>
+
+constexpr size_t LARGEST_COUNT = 10;
+constexpr size_t PREVIEW_LENGTH = 40;
+constexpr size_t MAX_GRAPH_DEPTH = 32; // deeper paths are folded into their ancestor at this depth
+constexpr size_t NO_PARENT = SIZE_MAX;
+
+// bytes_ counts the objects themselves. retained_ is what collecting them would free:
+// each object with everything only reachable through it, counting objects nested
+// under another member of the group once
+struct SnapshotEntry
+{
+	size_t count_ = 0;
+	size_t bytes_ = 0;
+	size_t retained_ = 0;
+};
+
+struct LargeObject
+{
+	size_t bytes_;
+	size_t retained_;
+	size_t length_;
+	std::string preview_; // strings only
+};
+
+struct Snapshot
+{
+	size_t objects_ = 0;
+	size_t bytes_ = 0;
+	std::array<SnapshotEntry, OBJ_TYPE_COUNT> types_{};
+	std::map<std::string, SnapshotEntry> classes_;
+	std::vector<LargeObject> arrays_, jsons_, strings_;
+	std::map<std::string, size_t> graph_; // collapsed stacks, root first, to bytes
+};
+
+template <typename Fn>
+static void for_each_reference(Obj *obj, Fn &&fn)
+{
+	auto value = [&fn](const Value &v)
+	{
+		if (v.is_obj())
+			fn(v.as<Obj *>());
+	};
+	auto table = [&](const Table &t)
+	{
+		for (auto &[k, v] : t)
+		{
+			fn(k);
+			value(v);
+		}
+	};
+	switch (obj->type_)
+	{
+	case ObjType::BoundMethod:
+	{
+		auto bound = static_cast<ObjBoundMethod *>(obj);
+		value(bound->receiver_);
+		fn(bound->method_);
+		break;
+	}
+	case ObjType::Class:
+	{
+		auto objClass = static_cast<ObjClass *>(obj);
+		fn(objClass->name_);
+		table(objClass->methods_);
+		break;
+	}
+	case ObjType::Closure:
+	{
+		auto closure = static_cast<ObjClosure *>(obj);
+		fn(closure->function_);
+		for (auto upvalue : closure->upvalues_)
+			fn(upvalue);
+		break;
+	}
+	case ObjType::Function:
+	{
+		auto function = static_cast<ObjFunction *>(obj);
+		fn(function->name_);
+		for (auto &constant : function->chunk_.constants_)
+			value(constant);
+		for (auto &table : function->chunk_.switches_)
+			for (auto &[label, _] : table.cases_)
+				value(label);
+		break;
+	}
+	case ObjType::Instance:
+	{
+		auto instance = static_cast<ObjInstance *>(obj);
+		fn(instance->objClass_);
+		table(instance->fields_);
+		for (auto [method, bound] : instance->bound_methods_)
+			fn(bound);
+		break;
+	}
+	case ObjType::Upvalue:
+		value(static_cast<ObjUpvalue *>(obj)->closed_);
+		break;
+	case ObjType::String:
+	{
+		auto str = static_cast<ObjString *>(obj);
+		if (str->slice_)
+			fn(static_cast<ObjSlice *>(str)->parent_);
+		break;
+	}
+	case ObjType::Array:
+		for (auto &v : static_cast<ObjArray *>(obj)->values_)
+			value(v);
+		break;
+	case ObjType::Json:
+		for (auto &[k, v] : static_cast<ObjJson *>(obj)->kv_)
+		{
+			value(k);
+			value(v);
+		}
+		break;
+	case ObjType::Coroutine:
+	{
+		auto co = static_cast<ObjCoroutine *>(obj);
+		if (co->status_ == CoroutineStatus::FINISHED)
+			break;
+		fn(co->closure_);
+		for (int i = 0; i < co->top_; i++)
+			value(co->stack_[i]);
+		for (auto &arg : co->arguments_)
+			value(arg);
+		for (int i = 0; i < co->frame_count_; i++)
+			fn(co->frames_[i].closure_);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static std::string label_of(const Obj *obj)
+{
+	auto function_name = [](const ObjFunction *function)
+	{
+		return function->name_ == nullptr ? std::string("<script>")
+										   : "fn " + std::string(function->name_->text());
+	};
+	switch (obj->type_)
+	{
+	case ObjType::Instance:
+		return std::string(static_cast<const ObjInstance *>(obj)->objClass_->name_->text());
+	case ObjType::Class:
+		return "class " + std::string(static_cast<const ObjClass *>(obj)->name_->text());
+	case ObjType::Closure:
+		return function_name(static_cast<const ObjClosure *>(obj)->function_);
+	case ObjType::Function:
+		return function_name(static_cast<const ObjFunction *>(obj));
+	default:
+		return std::string(nameof(obj->type_));
+	}
+}
+
+static void keep_largest(std::vector<LargeObject> &objects)
+{
+	auto by_bytes = [](const LargeObject &a, const LargeObject &b)
+	{ return a.retained_ > b.retained_; };
+	if (objects.size() > LARGEST_COUNT)
+	{
+		std::partial_sort(objects.begin(), objects.begin() + LARGEST_COUNT, objects.end(), by_bytes);
+		objects.resize(LARGEST_COUNT);
+	}
+	else
+		std::sort(objects.begin(), objects.end(), by_bytes);
+}
+
+// Immediate dominators with the iterative algorithm of Cooper, Harvey and Kennedy, as
+// V8 builds them for its heap snapshots. Vertex root is a virtual root above every GC
+// root. Returns the dominators and the vertices in post order, where an object comes
+// before the objects dominating it.
+static std::pair<std::vector<size_t>, std::vector<size_t>>
+dominators(size_t root, const std::vector<size_t> &offsets, const std::vector<size_t> &targets)
+{
+	auto count = offsets.size() - 1;
+	std::vector<size_t> order, number(count, NO_PARENT);
+	order.reserve(count);
+	std::vector<std::pair<size_t, size_t>> stack{{root, offsets[root]}};
+	number[root] = 0;
+	while (!stack.empty())
+	{
+		auto &[v, next] = stack.back();
+		if (next == offsets[v + 1])
+		{
+			number[v] = order.size();
+			order.push_back(v);
+			stack.pop_back();
+			continue;
+		}
+		auto w = targets[next++];
+		if (number[w] == NO_PARENT)
+		{
+			number[w] = 0; // on the stack
+			stack.emplace_back(w, offsets[w]);
+		}
+	}
+
+	std::vector<size_t> pred_offsets(count + 1, 0), preds(targets.size());
+	for (auto w : targets)
+		pred_offsets[w + 1]++;
+	for (size_t v = 0; v < count; v++)
+		pred_offsets[v + 1] += pred_offsets[v];
+	auto fill = pred_offsets;
+	for (size_t v = 0; v < count; v++)
+		for (auto e = offsets[v]; e < offsets[v + 1]; e++)
+			preds[fill[targets[e]]++] = v;
+
+	std::vector<size_t> idom(count, NO_PARENT);
+	idom[root] = root;
+	auto intersect = [&](size_t a, size_t b)
+	{
+		while (a != b)
+		{
+			while (number[a] < number[b])
+				a = idom[a];
+			while (number[b] < number[a])
+				b = idom[b];
+		}
+		return a;
+	};
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (auto it = order.rbegin() + 1; it != order.rend(); ++it)
+		{
+			auto v = *it;
+			auto dom = NO_PARENT;
+			for (auto e = pred_offsets[v]; e < pred_offsets[v + 1]; e++)
+				if (idom[preds[e]] != NO_PARENT)
+					dom = dom == NO_PARENT ? preds[e] : intersect(preds[e], dom);
+			if (idom[v] != dom)
+			{
+				idom[v] = dom;
+				changed = true;
+			}
+		}
+	}
+	return {std::move(idom), std::move(order)};
+}
+
+// Breadth first from the same roots mark_roots uses, so every object gets the
+// shortest path to a root as its place in the graph.
+void GC::take_snapshot(Snapshot &snapshot, bool graph)
+{
+	std::vector<Obj *> nodes;
+	std::vector<size_t> parents;
+	std::vector<size_t> anchors; // the node itself or its ancestor at MAX_GRAPH_DEPTH
+	std::vector<size_t> depths;
+	std::vector<std::string> root_labels;
+	std::unordered_map<size_t, size_t> root_of; // node to root label
+	std::unordered_map<Obj *, size_t> seen;
+	std::vector<std::pair<size_t, size_t>> edges; // NO_PARENT stands for the virtual root
+
+	auto visit = [&](Obj *obj, size_t parent)
+	{
+		if (obj == nullptr)
+			return;
+		auto found = seen.find(obj);
+		if (found != seen.end())
+		{
+			edges.emplace_back(parent, found->second);
+			return;
+		}
+		auto index = nodes.size();
+		seen.emplace(obj, index);
+		edges.emplace_back(parent, index);
+		nodes.push_back(obj);
+		parents.push_back(parent);
+		auto depth = parent == NO_PARENT ? 1 : depths[parent] + 1;
+		depths.push_back(depth);
+		anchors.push_back(depth <= MAX_GRAPH_DEPTH ? index : anchors[parent]);
+		if (parent == NO_PARENT)
+			root_of.emplace(index, root_labels.size() - 1);
+	};
+	auto root = [&](std::string label, Obj *obj)
+	{
+		root_labels.push_back(std::move(label));
+		visit(obj, NO_PARENT);
+	};
+	auto root_value = [&](std::string label, const Value &value)
+	{
+		if (value.is_obj())
+			root(std::move(label), value.as<Obj *>());
+	};
+
+	auto co = vm_.current_coroutine_;
+	if (co != nullptr)
+	{
+		for (int slot = 0; slot < co->top_; slot++)
+			root_value("stack", co->stack_[slot]);
+		for (int i = 0; i < co->frame_count_; i++)
+			root("frames", co->frames_[i].closure_);
+	}
+	for (auto upvalue = vm_.open_upvalues_; upvalue != nullptr; upvalue = upvalue->next_)
+		root("open upvalues", upvalue);
+	root("coroutines", vm_.scheduler_.current_coroutine_);
+	for (auto queued : vm_.scheduler_.coroutines_)
+		if (queued->status_ != CoroutineStatus::FINISHED)
+			root("coroutines", queued);
+	for (auto &[name, value] : vm_.globals_)
+		root_value("globals;" + std::string(name->text()), value);
+	for (auto compiler = vm_.cu_.current_.get(); compiler != nullptr; compiler = compiler->enclosing_.get())
+		root("compiler", compiler->function_);
+	root("vm", vm_.init_string_);
+	for (auto &[obj, count] : pins_)
+		root("pinned", obj);
+
+	for (size_t i = 0; i < nodes.size(); i++)
+		for_each_reference(nodes[i], [&](Obj *child)
+						   { visit(child, i); });
+
+	// the virtual root is vertex n, after the objects
+	auto n = nodes.size();
+	std::vector<size_t> offsets(n + 2, 0), targets(edges.size());
+	for (auto &[from, to] : edges)
+		offsets[(from == NO_PARENT ? n : from) + 1]++;
+	for (size_t v = 0; v <= n; v++)
+		offsets[v + 1] += offsets[v];
+	auto fill = offsets;
+	for (auto &[from, to] : edges)
+		targets[fill[from == NO_PARENT ? n : from]++] = to;
+	edges = {};
+	auto [idom, order] = dominators(n, offsets, targets);
+
+	std::vector<size_t> retained(n + 1, 0);
+	for (size_t i = 0; i < n; i++)
+		retained[i] = obj_footprint(nodes[i]);
+	for (auto v : order)
+		if (v != n)
+			retained[idom[v]] += retained[v];
+
+	// a group's retained bytes add up its members no other member dominates, found
+	// walking the dominator tree with a count of the members above
+	std::vector<size_t> children(n + 2, 0), tree(n);
+	for (size_t v = 0; v < n; v++)
+		children[idom[v] + 1]++;
+	for (size_t v = 0; v <= n; v++)
+		children[v + 1] += children[v];
+	fill = children;
+	for (size_t v = 0; v < n; v++)
+		tree[fill[idom[v]]++] = v;
+	std::array<size_t, OBJ_TYPE_COUNT> types_above{};
+	std::unordered_map<std::string_view, size_t> classes_above;
+	std::vector<std::pair<size_t, bool>> walk; // vertex, leaving
+	for (auto e = children[n]; e < children[n + 1]; e++)
+		walk.emplace_back(tree[e], false);
+	while (!walk.empty())
+	{
+		auto [v, leaving] = walk.back();
+		walk.pop_back();
+		auto obj = nodes[v];
+		auto type = static_cast<size_t>(obj->type_);
+		auto class_name = obj->type_ == ObjType::Instance ? static_cast<ObjInstance *>(obj)->objClass_->name_->text() : std::string_view();
+		if (leaving)
+		{
+			types_above[type]--;
+			if (!class_name.empty())
+				classes_above[class_name]--;
+			continue;
+		}
+		if (types_above[type]++ == 0)
+			snapshot.types_[type].retained_ += retained[v];
+		if (!class_name.empty() && classes_above[class_name]++ == 0)
+			snapshot.classes_[std::string(class_name)].retained_ += retained[v];
+		walk.emplace_back(v, true);
+		for (auto e = children[v]; e < children[v + 1]; e++)
+			walk.emplace_back(tree[e], false);
+	}
+
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		auto obj = nodes[i];
+		auto bytes = obj_footprint(obj);
+		snapshot.objects_++;
+		snapshot.bytes_ += bytes;
+		auto &type = snapshot.types_[static_cast<size_t>(obj->type_)];
+		type.count_++;
+		type.bytes_ += bytes;
+		switch (obj->type_)
+		{
+		case ObjType::Instance:
+		{
+			auto &entry = snapshot.classes_[std::string(static_cast<ObjInstance *>(obj)->objClass_->name_->text())];
+			entry.count_++;
+			entry.bytes_ += bytes;
+			break;
+		}
+		case ObjType::Array:
+			snapshot.arrays_.push_back({bytes, retained[i], static_cast<ObjArray *>(obj)->size(), {}});
+			break;
+		case ObjType::Json:
+			snapshot.jsons_.push_back({bytes, retained[i], static_cast<ObjJson *>(obj)->kv_.size(), {}});
+			break;
+		case ObjType::String:
+		{
+			auto text = static_cast<ObjString *>(obj)->text();
+			snapshot.strings_.push_back({bytes, retained[i], text.size(), std::string(text.substr(0, PREVIEW_LENGTH))});
+			break;
+		}
+		default:
+			break;
+		}
+
+		if (graph)
+		{
+			// root;label;...;label bytes, the format flamegraph.pl and speedscope read
+			std::vector<size_t> path;
+			for (auto at = anchors[i]; at != NO_PARENT; at = parents[at])
+				path.push_back(at);
+			auto line = root_labels[root_of.at(path.back())];
+			for (auto it = path.rbegin(); it != path.rend(); ++it)
+				line += ";" + label_of(nodes[*it]);
+			if (anchors[i] != i)
+				line += ";...";
+			snapshot.graph_[line] += bytes;
+		}
+	}
+	keep_largest(snapshot.arrays_);
+	keep_largest(snapshot.jsons_);
+	keep_largest(snapshot.strings_);
+}
+
+static void write_graph(const Snapshot &snapshot, const char *path)
+{
+	std::ofstream file(path);
+	if (!file)
+		throw NativeError(std::string("Could not open file: ") + path);
+	for (auto &[line, bytes] : snapshot.graph_)
+		file << line << ' ' << bytes << '\n';
+}
+
+static Value saturate(size_t n)
+{
+	return static_cast<int>(std::min<size_t>(n, std::numeric_limits<int>::max()));
+}
+
+ObjJson *GC::heap_snapshot(const char *graph_path)
+{
+	// take it before allocating the result so the snapshot does not see itself
+	Snapshot snapshot;
+	take_snapshot(snapshot, graph_path != nullptr);
+	if (graph_path != nullptr)
+		write_graph(snapshot, graph_path);
+
+	Pinned<ObjJson> root(*this, create_obj<ObjJson>(*this));
+	auto entry = [this](ObjJson *parent, std::string_view key, const SnapshotEntry &e)
+	{
+		auto json = json_child(parent, key);
+		json_set(json, "count", saturate(e.count_));
+		json_set(json, "bytes", saturate(e.bytes_));
+		json_set(json, "retained", saturate(e.retained_));
+	};
+	auto largest = [this, &root](std::string_view key, const std::vector<LargeObject> &objects)
+	{
+		Pinned<ObjArray> array(*this, create_obj<ObjArray>(*this, 0));
+		json_set(root.get(), key, array.get());
+		for (auto &object : objects)
+		{
+			Pinned<ObjJson> json(*this, create_obj<ObjJson>(*this));
+			json_set(json.get(), "bytes", saturate(object.bytes_));
+			json_set(json.get(), "retained", saturate(object.retained_));
+			json_set(json.get(), "length", saturate(object.length_));
+			if (!object.preview_.empty())
+				json_set(json.get(), "preview", create_obj_string(std::string_view(object.preview_), vm_));
+			array->push(json.get());
+		}
+	};
+
+	json_set(root.get(), "objects", saturate(snapshot.objects_));
+	json_set(root.get(), "bytes", saturate(snapshot.bytes_));
+	auto types = json_child(root.get(), "types");
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++)
+		if (snapshot.types_[i].count_ != 0)
+			entry(types, nameof(ObjType(i)), snapshot.types_[i]);
+	auto classes = json_child(root.get(), "classes");
+	for (auto &[name, e] : snapshot.classes_)
+		entry(classes, name, e);
+	largest("largestArrays", snapshot.arrays_);
+	largest("largestJson", snapshot.jsons_);
+	largest("largestStrings", snapshot.strings_);
+	return root.get();
+}
+
+void GC::dump_snapshot(std::ostream &os, const char *graph_path)
+{
+	Snapshot snapshot;
+	take_snapshot(snapshot, graph_path != nullptr);
+
+	os << "heap: " << snapshot.objects_ << " objects, " << snapshot.bytes_ << " bytes\n";
+	for (size_t i = 0; i < OBJ_TYPE_COUNT; i++)
+		if (snapshot.types_[i].count_ != 0)
+			os << "heap: " << snapshot.types_[i].count_ << " " << nameof(ObjType(i)) << ", "
+			   << snapshot.types_[i].bytes_ << " bytes, " << snapshot.types_[i].retained_ << " retained\n";
+	for (auto &[name, e] : snapshot.classes_)
+		os << "heap: " << e.count_ << " instances of " << name << ", " << e.bytes_ << " bytes, "
+		   << e.retained_ << " retained\n";
+	auto largest = [&os](const char *what, const std::vector<LargeObject> &objects)
+	{
+		for (auto &object : objects)
+		{
+			os << "heap: " << what << " of " << object.length_ << ", " << object.bytes_ << " bytes, "
+			   << object.retained_ << " retained";
+			if (!object.preview_.empty())
+				os << " \"" << object.preview_ << "\"";
+			os << "\n";
+		}
+	};
+	largest("array", snapshot.arrays_);
+	largest("json", snapshot.jsons_);
+	largest("string", snapshot.strings_);
+	os.flush();
+	// last, so the summary is printed even when the file cannot be written
+	if (graph_path != nullptr)
+		write_graph(snapshot, graph_path);
+}
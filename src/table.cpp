@@ -0,0 +1,60 @@
+#include "table.hpp"
+#include "objstring.hpp"
+#include <algorithm>
+
+constexpr size_t MIN_CAPACITY = 64;
+
+ObjString *StringTable::tombstone() noexcept
+{
+	static char sentinel;
+	return reinterpret_cast<ObjString *>(&sentinel);
+}
+
+ObjString *StringTable::find(std::string_view text, uint32_t hash) const
+{
+	if (slots_.empty())
+		return nullptr;
+	auto mask = slots_.size() - 1;
+	for (auto i = hash & mask;; i = (i + 1) & mask)
+	{
+		auto str = slots_[i];
+		if (str == nullptr)
+			return nullptr;
+		if (str != tombstone() && str->hash_ == hash && str->text() == text)
+			return str;
+	}
+}
+
+void StringTable::insert(ObjString *str)
+{
+	if ((count_ + tombstones_ + 1) * 4 > slots_.size() * 3)
+		grow();
+	auto mask = slots_.size() - 1;
+	auto i = str->hash_ & mask;
+	while (slots_[i] != nullptr && slots_[i] != tombstone())
+		i = (i + 1) & mask;
+	if (slots_[i] == tombstone())
+		tombstones_--;
+	slots_[i] = str;
+	count_++;
+}
+
+void StringTable::grow()
+{
+	// only double when the live strings need it, otherwise rehashing just drops the tombstones
+	auto capacity = std::max(slots_.size(), MIN_CAPACITY);
+	if ((count_ + 1) * 2 > capacity)
+		capacity *= 2;
+	std::vector<ObjString *> slots(capacity, nullptr);
+	auto mask = capacity - 1;
+	for (auto str : slots_)
+		if (str != nullptr && str != tombstone())
+		{
+			auto i = str->hash_ & mask;
+			while (slots[i] != nullptr)
+				i = (i + 1) & mask;
+			slots[i] = str;
+		}
+	slots_.swap(slots);
+	tombstones_ = 0;
+}
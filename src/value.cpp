@@ -14,7 +14,13 @@ bool operator==(const Obj *obj, const std::monostate nil)
 
 bool operator==(const Value &v1, const Value &v2)
 {
-	return v1.value_ == v2.value_;
+	if (v1.value_ == v2.value_)
+		return true;
+	// interned strings are equal only when identical, slices are not interned
+	if (!v1.is_obj_type<ObjString>() || !v2.is_obj_type<ObjString>())
+		return false;
+	auto s1 = v1.as_obj<ObjString>(), s2 = v2.as_obj<ObjString>();
+	return (s1->slice_ || s2->slice_) && s1->hash_ == s2->hash_ && s1->text() == s2->text();
 }
 
 bool operator!=(const Value &v1, const Value &v2)
@@ -106,6 +112,8 @@ template auto Value::is_obj_type<ObjJson>() const -> typename std::enable_if_t<s
 template auto Value::as_obj<ObjJson>() const -> typename std::enable_if_t<std::is_base_of_v<Obj, ObjJson> && !std::is_same_v<Obj, ObjJson>, ObjJson *>;
 template auto Value::is_obj_type<ObjCoroutine>() const -> typename std::enable_if_t<std::is_base_of_v<Obj, ObjCoroutine> && !std::is_same_v<Obj, ObjCoroutine>, bool>;
 template auto Value::as_obj<ObjCoroutine>() const -> typename std::enable_if_t<std::is_base_of_v<Obj, ObjCoroutine> && !std::is_same_v<Obj, ObjCoroutine>, ObjCoroutine *>;
+template auto Value::is_obj_type<ObjStringBuilder>() const -> typename std::enable_if_t<std::is_base_of_v<Obj, ObjStringBuilder> && !std::is_same_v<Obj, ObjStringBuilder>, bool>;
+template auto Value::as_obj<ObjStringBuilder>() const -> typename std::enable_if_t<std::is_base_of_v<Obj, ObjStringBuilder> && !std::is_same_v<Obj, ObjStringBuilder>, ObjStringBuilder *>;
 
 template <typename U>
 auto Value::is_obj_type() const -> typename std::enable_if_t<std::is_base_of_v<Obj, U> && !std::is_same_v<Obj, U>, bool>
@@ -1,4 +1,5 @@
 #include "vm.hpp"
+#include <algorithm>
 #include <iostream>
 #include <functional>
 #include "util.hpp"
@@ -6,17 +7,153 @@
 #include "object.hpp"
 #include "value.hpp"
 #include "native.hpp"
+#include "profiler.hpp"
+#include "sort.hpp"
 #include <string_view>
 
-VM::VM() : cu_(*this), globals_(), gc_(*this), scheduler_(*this)
+VM::VM(const GCConfig &config) : cu_(*this), globals_(), gc_(*this, config), scheduler_(*this)
 {
     AllocBase::init(&gc_);
     init_string_ = create_obj_string(std::string_view("init"), *this);
-    define_native("clock", Native::clock);
-    define_native("insert", Native::insert);
-    define_native("erase", Native::erase);
-    define_native("push", Native::push);
-    define_native("pop", Native::pop);
+    define_native<&Native::clock>("clock");
+    define_native<&Native::insert>("insert");
+    define_native<&Native::erase>("erase");
+    define_native<&Native::push>("push");
+    define_native<&Native::pop>("pop");
+    define_native<&Native::sum>("sum");
+    define_native<&Native::min>("min");
+    define_native<&Native::max>("max");
+    define_native<&Native::dot>("dot");
+    define_native<&Native::fill>("fill");
+    define_native<&Native::index_of>("indexOf");
+    define_native<&Native::map>("map");
+    define_native<&Native::filter>("filter");
+    define_native<&Native::reduce>("reduce");
+    define_native<&Native::for_each>("forEach");
+    define_native<&Native::sort>("sort");
+    define_native<&Native::add>("add");
+    define_native<&Native::mul>("mul");
+    define_native<&Native::string_builder>("stringBuilder");
+    define_native("append", Native::append);
+    define_native<&Native::to_string>("toString");
+    define_native<&Native::substr>("substr");
+    define_native<&Native::slice>("slice");
+    define_native<&Native::split>("split");
+    define_native<&Native::json_parse>("jsonParse");
+    define_native<&Native::json_stringify>("jsonStringify");
+    define_native<&Native::gc>("gc");
+    define_native<&Native::gc_stats>("gcStats");
+    define_native<&Native::heap_snapshot>("heapSnapshot");
+    define_native<&Native::alloc_profile>("allocProfile");
+}
+
+VM::~VM()
+{
+    // members are destroyed in reverse order, so by ~GC the scheduler and its
+    // coroutines are gone and the snapshot would walk freed roots
+    gc_.report_exit();
+}
+
+// a new packed array of a[i] op b[i]
+ObjArray *VM::elementwise(ObjArray *a, ObjArray *b, void (*kernel)(const int *, const int *, int *, size_t))
+{
+    std::vector<int> scratch_a, scratch_b;
+    if (a->size() != b->size())
+        throw NativeError("Expected arrays of the same length.");
+    auto lhs = Native::ints_of(a, scratch_a);
+    auto rhs = Native::ints_of(b, scratch_b);
+    Pinned<ObjArray> result(gc_, create_obj<ObjArray>(gc_, 0));
+    result->ints_.resize(a->size());
+    kernel(lhs, rhs, result->ints_.data(), a->size());
+    return result.get();
+}
+
+namespace
+{
+    // while a native runs script code it holds objects by address
+    struct Reentry
+    {
+        int &depth_;
+        explicit Reentry(int &depth) : depth_(depth) { depth_++; }
+        ~Reentry() { depth_--; }
+    };
+}
+
+// calls callee from inside a native and returns its result. a closure gets a frame on the
+// current coroutine and the VM runs until that frame returns, no stack or coroutine is set up.
+// until then compaction waits and yield/resume are runtime errors
+Value VM::call_closure(const Value &callee, const Value *args, int argCount)
+{
+    auto co = current_coroutine_;
+    auto depth = co->frame_count_;
+    push(callee);
+    for (int i = 0; i < argCount; i++)
+        push(args[i]);
+    Reentry reentry(reentry_depth_);
+    if (!call_value(callee, argCount))
+        throw ScriptError();
+    if (co->frame_count_ > depth && run(co, depth) != INTERPRET_OK)
+        throw ScriptError();
+    return pop();
+}
+
+Value VM::call_closure(const Value &callee, std::initializer_list<Value> args)
+{
+    return call_closure(callee, args.begin(), static_cast<int>(args.size()));
+}
+
+// sort(array[, cmp]) sorts in place and returns array. cmp(a, b) returns a number below
+// zero or true when a goes first; without it the elements must be all numbers or all strings
+ObjArray *VM::sort_array(ObjArray *target, std::optional<Value> cmp)
+{
+    Pinned<ObjArray> array(gc_, target);
+    if (!cmp)
+    {
+        if (array->packed_)
+        {
+            std::sort(array->ints_.begin(), array->ints_.end());
+            return target;
+        }
+        auto &values = array->values_;
+        if (std::all_of(values.begin(), values.end(), [](const Value &v)
+                        { return v.is_number(); }))
+            std::sort(values.begin(), values.end(), [](const Value &a, const Value &b)
+                      { return a.as<int>() < b.as<int>(); });
+        else if (std::all_of(values.begin(), values.end(), [](const Value &v)
+                             { return v.is_obj_type<ObjString>(); }))
+            std::sort(values.begin(), values.end(), [](const Value &a, const Value &b)
+                      { return a.as_obj<ObjString>()->text() < b.as_obj<ObjString>()->text(); });
+        else
+            throw NativeError("Expected a comparator unless the elements are all numbers or all strings.");
+        return target;
+    }
+
+    auto less = [this, &cmp](const Value &a, const Value &b)
+    {
+        auto order = call_closure(*cmp, {a, b});
+        if (order.is_bool())
+            return order.as<bool>();
+        if (order.is_number())
+            return order.as<int>() < 0;
+        throw NativeError("Comparator must return a number or a bool.");
+    };
+    // sort a copy the comparator cannot reach, then write it back
+    if (array->packed_)
+    {
+        std::vector<int> ints(array->ints_.begin(), array->ints_.end());
+        introsort(ints.begin(), ints.end(), [&less](int a, int b)
+                  { return less(a, b); });
+        if (array->packed_)
+            array->ints_.assign(ints.begin(), ints.end());
+        else
+            array->values_.assign(ints.begin(), ints.end());
+        return target;
+    }
+    Pinned<ObjArray> sorted(gc_, create_obj<ObjArray>(gc_, 0));
+    sorted->values_ = array->values_;
+    introsort(sorted->values_.begin(), sorted->values_.end(), less);
+    array->values_ = sorted->values_;
+    return target;
 }
 
 bool VM::call_value(const Value &callee, uint8_t argCount)
@@ -53,8 +190,21 @@ bool VM::call_value(const Value &callee, uint8_t argCount)
             return call(callee.as_obj<ObjClosure>(), argCount); // add new frame
         case ObjType::Native:
         {
-            auto native = callee.as_obj<ObjNative>()->function_;
-            auto result = native(argCount, current_coroutine_->stack_.data() + current_coroutine_->top_ - argCount);
+            auto native = callee.as_obj<ObjNative>();
+            Value result;
+            try
+            {
+                result = native->function_(*this, argCount, current_coroutine_->stack_.data() + current_coroutine_->top_ - argCount);
+            }
+            catch (const NativeError &e)
+            {
+                runtime_error(native->name_, ": ", e.what());
+                return false;
+            }
+            catch (const ScriptError &)
+            {
+                return false;
+            }
             current_coroutine_->top_ -= argCount + 1;
             push(result);
             return true;
@@ -145,7 +295,12 @@ ObjUpvalue *VM::capture_upvalue(Value *local)
 
 void VM::define_native(std::string_view name, NativeFn function)
 {
-    if (current_coroutine_ != nullptr)
+    if (current_coroutine_ == nullptr)
+    {
+        // before the first coroutine runs there are no roots and no collections
+        globals_.insert_or_assign(create_obj_string(name, *this), create_obj<ObjNative>(gc_, function, name));
+    }
+    else
     {
         push(create_obj_string(name, *this));
         push(create_obj<ObjNative>(gc_, function, name));
@@ -157,12 +312,21 @@ void VM::define_native(std::string_view name, NativeFn function)
 
 InterpretResult VM::interpret(const std::string &source)
 {
-    ObjFunction *function = cu_.compile(source);
-    if (function == nullptr)
-        return InterpretResult::INTERPRET_COMPILE_ERROR;
-
-    ObjClosure *closure = create_obj<ObjClosure>(gc_, function);
-    ObjCoroutine *co = create_obj<ObjCoroutine>(gc_, closure); // modify
+    ObjCoroutine *co = nullptr;
+    try
+    {
+        ObjFunction *function = cu_.compile(source);
+        if (function == nullptr)
+            return InterpretResult::INTERPRET_COMPILE_ERROR;
+        ObjClosure *closure = create_obj<ObjClosure>(gc_, function);
+        co = create_obj<ObjCoroutine>(gc_, closure); // modify
+    }
+    catch (const OutOfMemory &e)
+    {
+        cu_.reset();
+        std::cerr << e.what() << '\n';
+        return INTERPRET_RUNTIME_ERROR;
+    }
     // in memory.cpp current_coroutine is nullptr to gc
 
     scheduler_.addObjCoroutine(co);
@@ -170,7 +334,7 @@ InterpretResult VM::interpret(const std::string &source)
     co->stack_[0] = co->closure_;
     co->top_ = 1;
     co->frame_count_ = 1;
-    co->frames_[0].closure_ = closure;
+    co->frames_[0].closure_ = co->closure_;
     co->frames_[0].ip_ = 0;
     co->frames_[0].slot_ = 0;
     return scheduler_.resumeCoroutine(co);
@@ -182,7 +346,21 @@ bool is_falsey(const Value &value)
            (value.is_bool() && !value.as<bool>());
 }
 
-InterpretResult VM::run(ObjCoroutine *co)
+// an allocation over the max heap size fails the instruction that made it
+InterpretResult VM::run(ObjCoroutine *co, int stop_depth)
+{
+    try
+    {
+        return dispatch(co, stop_depth);
+    }
+    catch (const OutOfMemory &e)
+    {
+        runtime_error(e.what());
+        return INTERPRET_RUNTIME_ERROR;
+    }
+}
+
+InterpretResult VM::dispatch(ObjCoroutine *co, int stop_depth)
 {
     current_coroutine_ = co;
     // current_coroutine_->stack_ = co->stack_;
@@ -193,6 +371,10 @@ InterpretResult VM::run(ObjCoroutine *co)
 
     while (co->status_ != CoroutineStatus::FINISHED)
     {
+        // safe point: between instructions only coroutines and frames are held by address,
+        // unless a native below is running script code and holds objects itself
+        if (gc_.compact_requested_ && reentry_depth_ == 0)
+            gc_.compact();
 #ifdef DEBUG_MODE
         printf("           stackframe: ");
         for (int i = 0; i < current_coroutine_->top_; i++)
@@ -208,6 +390,12 @@ InterpretResult VM::run(ObjCoroutine *co)
             Value result = pop();
             close_upvalues(current_coroutine_->stack_.data() + frame->slot_);
             current_coroutine_->frame_count_--; // leave current frame
+            if (current_coroutine_->frame_count_ == stop_depth && stop_depth > 0)
+            {
+                current_coroutine_->top_ = frame->slot_;
+                push(result);
+                return INTERPRET_OK;
+            }
             if (current_coroutine_->frame_count_ == 0)
             {
                 co->status_ = CoroutineStatus::FINISHED;
@@ -244,7 +432,10 @@ InterpretResult VM::run(ObjCoroutine *co)
             {
                 auto b = peek(0).as_obj<ObjString>();
                 auto a = peek(1).as_obj<ObjString>();
-                auto res = create_obj_string(std::string_view(a->content_ + b->content_), *this);
+                // joined in a reused buffer, an interned result costs no allocation
+                concat_buffer_.assign(a->text());
+                concat_buffer_.append(b->text());
+                auto res = create_obj_string(std::string_view(concat_buffer_), *this);
                 pop();
                 pop();
                 push(res);
@@ -387,6 +578,93 @@ InterpretResult VM::run(ObjCoroutine *co)
             frame->ip_ -= offset;
             break;
         }
+        case OP_ITER_INIT:
+        {
+            if (!peek(0).is_obj_type<ObjArray>() && !peek(0).is_obj_type<ObjJson>())
+            {
+                runtime_error("Can only iterate over arrays and Json.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            push(Value(0)); // the cursor
+            break;
+        }
+        case OP_ITER_NEXT:
+        {
+            // the collection, its cursor and the loop variable are consecutive locals
+            Value *slots = &current_coroutine_->stack_[frame->slot_ + frame->read_byte()];
+            int offset = frame->read_short();
+            size_t cursor = slots[1].as<int>();
+            auto collection = slots[0].as<Obj *>();
+            if (collection->is_type(objtype_of<ObjArray>()))
+            {
+                auto array = static_cast<ObjArray *>(collection);
+                if (cursor >= array->size())
+                {
+                    frame->ip_ += offset;
+                    break;
+                }
+                slots[2] = array->packed_ ? Value(array->ints_[cursor]) : array->values_[cursor];
+            }
+            else
+            {
+                auto &kv = static_cast<ObjJson *>(collection)->kv_;
+                if (cursor >= kv.size())
+                {
+                    frame->ip_ += offset;
+                    break;
+                }
+                slots[2] = kv.begin()[cursor].key_;
+            }
+            slots[1] = Value(static_cast<int>(cursor + 1));
+            break;
+        }
+        case OP_RANGE_INIT:
+        {
+            if (!peek(0).is_number() || !peek(1).is_number())
+            {
+                runtime_error("Range bounds must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            break;
+        }
+        case OP_FOR_RANGE:
+        case OP_FOR_COUNT:
+        {
+            // the counter, the bound and the loop variable are consecutive locals. nothing
+            // else can name the first two, so they are still the ints OP_RANGE_INIT checked
+            Value *slots = &current_coroutine_->stack_[frame->slot_ + frame->read_byte()];
+            int offset = frame->read_short();
+            int &counter = *std::get_if<int>(&slots[0].value_);
+            if (counter < *std::get_if<int>(&slots[1].value_))
+            {
+                if (instruction == OP_FOR_RANGE)
+                    slots[2] = Value(counter);
+                counter++;
+                frame->ip_ -= offset;
+            }
+            break;
+        }
+        case OP_TABLE_SWITCH:
+        {
+            auto &table = frame->closure_->function_->chunk_.switches_[frame->read_byte()];
+            auto value = pop();
+            frame->ip_ = table.default_;
+            if (value.is_number())
+            {
+                auto index = static_cast<int64_t>(value.as<int>()) - table.low_;
+                if (index >= 0 && index < static_cast<int64_t>(table.dense_.size()))
+                    frame->ip_ = table.dense_[index];
+            }
+            break;
+        }
+        case OP_HASH_SWITCH:
+        {
+            intern_key(0); // slices are compared by address too
+            auto &table = frame->closure_->function_->chunk_.switches_[frame->read_byte()];
+            auto found = table.cases_.find(pop());
+            frame->ip_ = found == table.cases_.end() ? table.default_ : found->second;
+            break;
+        }
         case OP_CONTINUE:
         case OP_BREAK:
         {
@@ -407,6 +685,80 @@ InterpretResult VM::run(ObjCoroutine *co)
             frame = &current_coroutine_->frames_[current_coroutine_->frame_count_ - 1]; // frame update, enter into function scope
             break;
         }
+        case OP_TAIL_CALL:
+        {
+            int argCount = frame->read_byte();
+            int depth = current_coroutine_->frame_count_;
+            if (!call_value(peek(argCount), argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            if (current_coroutine_->frame_count_ > depth)
+                reuse_frame();
+            frame = &current_coroutine_->frames_[current_coroutine_->frame_count_ - 1];
+            break;
+        }
+        case OP_TAIL_INVOKE:
+        {
+            ObjString *method = frame->read_string();
+            int argCount = frame->read_byte();
+            int depth = current_coroutine_->frame_count_;
+            if (!invoke(method, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            if (current_coroutine_->frame_count_ > depth)
+                reuse_frame();
+            frame = &current_coroutine_->frames_[current_coroutine_->frame_count_ - 1];
+            break;
+        }
+        case OP_GUARD_CALL:
+        {
+            int argCount = frame->read_byte();
+            auto expected = frame->read_constant();
+            int skip = frame->read_short();
+            auto callee = peek(argCount);
+            if (callee.is_obj_type<ObjClosure>() && expected == Value(callee.as_obj<ObjClosure>()->function_))
+            {
+                // the inlined body runs on the arguments alone
+                auto top = current_coroutine_->stack_.begin() + current_coroutine_->top_;
+                std::move(top - argCount, top, top - argCount - 1);
+                current_coroutine_->top_--;
+                break;
+            }
+            frame->ip_ += skip;
+            if (!call_value(callee, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            frame = &current_coroutine_->frames_[current_coroutine_->frame_count_ - 1];
+            break;
+        }
+        case OP_GUARD_INVOKE:
+        {
+            auto name = frame->read_string();
+            int argCount = frame->read_byte();
+            auto expected = frame->read_constant();
+            int skip = frame->read_short();
+            auto receiver = peek(argCount);
+            if (receiver.is_obj_type<ObjInstance>())
+            {
+                auto instance = receiver.as_obj<ObjInstance>();
+                auto &methods = instance->objClass_->methods_;
+                auto method = methods.find(name);
+                if (method != methods.end() && expected == Value(method->second.as_obj<ObjClosure>()->function_) &&
+                    instance->fields_.find(name) == instance->fields_.end())
+                    break;
+            }
+            frame->ip_ += skip;
+            if (!invoke(name, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            frame = &current_coroutine_->frames_[current_coroutine_->frame_count_ - 1];
+            break;
+        }
+        case OP_INLINE_RETURN:
+        {
+            // the result replaces the callee and its arguments, as OP_RETURN leaves it
+            int count = frame->read_byte();
+            auto result = pop();
+            current_coroutine_->top_ -= count;
+            push(result);
+            break;
+        }
         case OP_FUNCTION:
         {
             auto function = frame->read_constant().as_obj<ObjFunction>();
@@ -540,9 +892,9 @@ InterpretResult VM::run(ObjCoroutine *co)
         case OP_ARRAY:
         {
             int count = frame->read_byte();
-            auto objArray = create_obj<ObjArray>(this->gc_, count);
-            for (int i = 0; i < count; i++)
-                objArray->values_.at(count - 1 - i) = pop();
+            auto first = current_coroutine_->stack_.data() + current_coroutine_->top_ - count;
+            auto objArray = create_obj<ObjArray>(this->gc_, first, count);
+            current_coroutine_->top_ -= count;
             push(objArray);
             break;
         }
@@ -551,14 +903,15 @@ InterpretResult VM::run(ObjCoroutine *co)
             if (peek(1).as<Obj *>()->is_type(objtype_of<ObjArray>()))
             {
                 auto index = pop().as<int>();
-                auto value = pop().as_obj<ObjArray>()->values_.at(index);
+                auto value = pop().as_obj<ObjArray>()->at(index);
                 push(value);
             }
             else
             { // json
+                intern_key(0);
                 auto key = pop();
-                auto value = pop().as_obj<ObjJson>()->kv_[key];
-                push(value);
+                auto found = pop().as_obj<ObjJson>()->kv_.find(key);
+                push(found != nullptr ? *found : Value());
             }
             break;
         }
@@ -571,20 +924,28 @@ InterpretResult VM::run(ObjCoroutine *co)
         {
             if (peek(2).as<Obj *>()->is_type(objtype_of<ObjArray>()))
             {
-                auto value = pop();
-                auto index = pop().as<int>();
-                auto array = pop().as_obj<ObjArray>();
-                int n = array->values_.size();
+                // stays on the stack, unpacking the array may collect
+                auto value = peek(0);
+                auto index = peek(1).as<int>();
+                auto array = peek(2).as_obj<ObjArray>();
+                int n = array->size();
                 if (index >= n)
+                {
                     runtime_error("Index is larger than array size.");
-                array->values_.at(index) = value;
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                array->set(index, value);
+                current_coroutine_->top_ -= 3;
                 push(value);
             }
             else
             {
-                auto value = pop();
-                auto key = pop();
-                pop().as_obj<ObjJson>()->kv_.insert_or_assign(key, value);
+                // like the array case, growing the map may collect
+                intern_key(1);
+                auto value = peek(0);
+                auto key = peek(1);
+                peek(2).as_obj<ObjJson>()->kv_.insert_or_assign(key, value);
+                current_coroutine_->top_ -= 3;
                 push(value);
             }
             break;
@@ -592,13 +953,18 @@ InterpretResult VM::run(ObjCoroutine *co)
         case OP_JSON:
         {
             int count = frame->read_byte();
-            auto objJson = create_obj<ObjJson>(this->gc_);
             for (int i = 0; i < count; i++)
+                intern_key(2 * i + 1);
+            auto objJson = create_obj<ObjJson>(this->gc_, count);
+            push(objJson); // keep it reachable while inserting may collect
+            // the first pair is deepest, inserting from there keeps the source order
+            for (int i = count - 1; i >= 0; i--)
             {
-                auto value = pop();
-                auto key = pop();
+                auto value = peek(2 * i + 1);
+                auto key = peek(2 * i + 2);
                 objJson->kv_[key] = value;
             }
+            current_coroutine_->top_ -= 2 * count + 1;
             push(objJson);
             break;
         }
@@ -609,9 +975,10 @@ InterpretResult VM::run(ObjCoroutine *co)
                 std::vector<Value> arguments;
                 auto count = frame->read_byte();
                 for (int i = 0; i < count; i++)
-                    arguments.push_back(pop());
-                auto closure = pop().as_obj<ObjClosure>();
+                    arguments.push_back(peek(i));
+                auto closure = peek(count).as_obj<ObjClosure>();
                 auto coroutine = create_obj<ObjCoroutine>(gc_, closure, arguments);
+                current_coroutine_->top_ -= count + 1;
                 push(coroutine);
                 scheduler_.addObjCoroutine(coroutine);
             }
@@ -623,11 +990,21 @@ InterpretResult VM::run(ObjCoroutine *co)
         }
         case OP_YIELD_COROUTINE:
         {
+            if (reentry_depth_ > 0)
+            {
+                runtime_error("Cannot yield inside a callback of a native.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
             scheduler_.yieldCurrentObjCoroutine();
             return scheduler_.runNextObjCoroutine();
         }
         case OP_RESUME_COROUTINE:
         {
+            if (reentry_depth_ > 0)
+            {
+                runtime_error("Cannot resume a coroutine inside a callback of a native.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
             scheduler_.yieldCurrentObjCoroutine();
             try
             {
@@ -687,6 +1064,29 @@ Value VM::peek(int distance)
     return current_coroutine_->stack_[current_coroutine_->top_ - 1 - distance];
 }
 
+// Json keys are hashed by address, a slice key is swapped in place for its interned string
+void VM::intern_key(int distance)
+{
+    auto &key = current_coroutine_->stack_[current_coroutine_->top_ - 1 - distance];
+    if (key.is_obj_type<ObjString>() && key.as_obj<ObjString>()->slice_)
+        key = intern(key.as_obj<ObjString>(), *this);
+}
+
+// The frame a tail call pushed takes the place of its caller's. The caller's locals
+// are dead, so their upvalues are closed and the callee's window slides down over them.
+void VM::reuse_frame()
+{
+    auto co = current_coroutine_;
+    CallFrame &caller = co->frames_[co->frame_count_ - 2];
+    CallFrame &callee = co->frames_[co->frame_count_ - 1];
+    close_upvalues(co->stack_.data() + caller.slot_);
+    std::copy(co->stack_.begin() + callee.slot_, co->stack_.begin() + co->top_, co->stack_.begin() + caller.slot_);
+    co->top_ -= callee.slot_ - caller.slot_;
+    caller.closure_ = callee.closure_;
+    caller.ip_ = 0;
+    co->frame_count_--;
+}
+
 void VM::close_upvalues(Value *last)
 {
     while (open_upvalues_ != NULL &&
@@ -711,10 +1111,18 @@ bool VM::bind_method(ObjClass *klass, ObjString *name)
 {
     try
     {
-        auto method = klass->methods_.at(name);
-        auto bound = create_obj<ObjBoundMethod>(gc_, peek(0), method.as_obj<ObjClosure>());
+        auto method = klass->methods_.at(name).as_obj<ObjClosure>();
+        auto instance = peek(0).as_obj<ObjInstance>();
+        if (auto cached = instance->bound_methods_.find(method); cached != instance->bound_methods_.end())
+        {
+            pop();
+            push(cached->second);
+            return true;
+        }
+        auto bound = create_obj<ObjBoundMethod>(gc_, peek(0), method);
         pop();
         push(bound);
+        instance->bound_methods_.emplace(method, bound);
         return true;
     }
     catch (const std::out_of_range &)
@@ -757,6 +1165,10 @@ void VM::runtime_error(Args &&...args)
         auto function = frame.closure_->function_;
         auto instruction = frame.ip_ - 1;
         auto line = function->chunk_.lines_.at(instruction);
+        for (auto &inlined : function->chunk_.inlined_)
+            if (inlined.begin_ <= instruction && instruction < inlined.end_)
+                std::cerr << "[line " << line << "] in "
+                          << function->chunk_.constants_[inlined.function_].as_obj<ObjFunction>()->name_->text() << "() (inlined)\n";
         std::cerr << "[line " << line << "] in ";
         if (function->name_ == nullptr)
             std::cerr << "script\n";
@@ -0,0 +1,41 @@
+# cmake -DLOX=<interpreter> -DSCRIPT=<tests/NAME.lox> -P run.cmake
+#
+# Runs the script and compares its stdout with NAME.out. With a NAME.err next to it
+# the script must print that on stderr, and fail unless the first line of NAME.err is
+# `// exit: 0`; without one it must succeed quietly.
+# A first line of the form `// args: --gc-growth=1.5` passes flags before the script.
+get_filename_component(dir ${SCRIPT} DIRECTORY)
+get_filename_component(name ${SCRIPT} NAME_WE)
+
+set(args)
+file(STRINGS ${SCRIPT} header LIMIT_COUNT 1)
+if(header MATCHES "^// args: (.*)$")
+    separate_arguments(args UNIX_COMMAND "${CMAKE_MATCH_1}")
+endif()
+
+execute_process(COMMAND ${LOX} ${args} ${SCRIPT}
+    OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE code)
+
+file(READ ${dir}/${name}.out expected_out)
+if(NOT out STREQUAL expected_out)
+    message(FATAL_ERROR "stdout differs\n--- expected\n${expected_out}--- got\n${out}--- stderr\n${err}")
+endif()
+
+if(EXISTS ${dir}/${name}.err)
+    file(READ ${dir}/${name}.err expected_err)
+    set(succeeds FALSE)
+    if(expected_err MATCHES "^// exit: 0\n(.*)$")
+        set(expected_err "${CMAKE_MATCH_1}")
+        set(succeeds TRUE)
+    endif()
+    if(succeeds AND NOT code EQUAL 0)
+        message(FATAL_ERROR "exit code ${code}\n${err}")
+    elseif(NOT succeeds AND code EQUAL 0)
+        message(FATAL_ERROR "expected the script to fail")
+    endif()
+    if(NOT err STREQUAL expected_err)
+        message(FATAL_ERROR "stderr differs\n--- expected\n${expected_err}--- got\n${err}")
+    endif()
+elseif(NOT code EQUAL 0 OR NOT err STREQUAL "")
+    message(FATAL_ERROR "exit code ${code}\n${err}")
+endif()